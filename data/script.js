@@ -4,30 +4,96 @@ const userTableBody = document.getElementById('userTable').getElementsByTagName(
 const lastReadCardsTableBody = document.getElementById('lastReadCardsTable').getElementsByTagName('tbody')[0];
 const importExportArea = document.getElementById('importExportArea');
 
-function updateTable() {
-    fetch('/getCards')
-        .then(response => response.json())
+// reads seen so far, fetched incrementally from /getCards
+let lastSequence = 0;
+let cardsTag = null;
+let cardsBoot = null;
+// reads per request, a long history loads in pages
+const CARDS_PAGE = 500;
+
+function addCardRow(card, index) {
+    let row = tableBody.insertRow();
+    let cellIndex = row.insertCell(0);
+    let cellReader = row.insertCell(1);
+    let cellBitLength = row.insertCell(2);
+    let cellFormat = row.insertCell(3);
+    let cellFacilityCode = row.insertCell(4);
+    let cellCardNumber = row.insertCell(5);
+    let cellHexData = row.insertCell(6);
+    let cellRawData = row.insertCell(7);
+
+    cellIndex.innerHTML = index + 1;
+    // 0 for reads logged before readers were numbered
+    cellReader.innerHTML = card.reader || '';
+    cellBitLength.innerHTML = card.bitCount;
+    cellFormat.innerHTML = card.format;
+    cellFacilityCode.innerHTML = card.facilityCode;
+    cellCardNumber.innerHTML = card.cardNumber;
+    cellHexData.innerHTML = `<a href="#" onclick="copyToClipboard('${card.hexCardData}')">${card.hexCardData}</a>`;
+    cellRawData.innerHTML = card.rawCardData;
+}
+
+// Fetches the reads after the last one seen; the device answers 304 while
+// there is nothing new
+function fetchCards() {
+    const headers = cardsTag ? { 'If-None-Match': cardsTag } : {};
+    return fetch(`/getCards?since=${lastSequence}&limit=${CARDS_PAGE}`, { headers: headers, cache: 'no-store' })
+        .then(response => {
+            if (response.status === 304) {
+                return null;
+            }
+            // sequences start over after a reboot
+            const boot = response.headers.get('X-Boot-Id');
+            if (boot !== cardsBoot) {
+                cardsBoot = boot;
+                cardData = [];
+                tableBody.innerHTML = '';
+                if (lastSequence > 0) {
+                    lastSequence = 0;
+                    cardsTag = null;
+                    return fetchCards().then(() => null);
+                }
+            }
+            cardsTag = response.headers.get('ETag');
+            return response.json();
+        })
         .then(data => {
-            tableBody.innerHTML = '';
-            data.forEach((card, index) => {
+            if (data === null) {
+                return;
+            }
+            data.forEach(card => {
+                addCardRow(card, cardData.length);
                 cardData.push(card);
-                let row = tableBody.insertRow();
-                let cellIndex = row.insertCell(0);
-                let cellBitLength = row.insertCell(1);
-                let cellFacilityCode = row.insertCell(2);
-                let cellCardNumber = row.insertCell(3);
-                let cellHexData = row.insertCell(4);
-                let cellRawData = row.insertCell(5);
-
-                cellIndex.innerHTML = index + 1;
-                cellBitLength.innerHTML = card.bitCount;
-                cellFacilityCode.innerHTML = card.facilityCode;
-                cellCardNumber.innerHTML = card.cardNumber;
-                cellHexData.innerHTML = `<a href="#" onclick="copyToClipboard('${card.hexCardData}')">${card.hexCardData}</a>`;
-                cellRawData.innerHTML = card.rawCardData;
+                lastSequence = card.sequence;
             });
-        })
-        .catch(error => console.error('Error fetching card data:', error));
+            updateLastReadCardsTable();
+            if (data.length === CARDS_PAGE) {
+                // more reads are waiting, the tag only covers this page
+                cardsTag = null;
+                return fetchCards();
+            }
+        });
+}
+
+let cardsLoading = false;
+let cardsAgain = false;
+
+function updateCards() {
+    // a poll waits for the previous one, both would add the same reads
+    if (cardsLoading) {
+        cardsAgain = true;
+        return;
+    }
+    cardsLoading = true;
+    fetchCards()
+        .catch(error => console.error('Error fetching card data:', error))
+        .finally(() => {
+            cardsLoading = false;
+            if (cardsAgain) {
+                cardsAgain = false;
+                updateCards();
+            }
+        });
 }
 
 function updateUserTable() {
@@ -47,7 +113,7 @@ function updateUserTable() {
                 cellFacilityCode.innerHTML = user.facilityCode;
                 cellCardNumber.innerHTML = user.cardNumber;
                 cellName.innerHTML = user.name;
-                cellAction.innerHTML = '<button onclick="deleteCard(' + index + ')">Delete</button>';
+                cellAction.innerHTML = `<button onclick="deleteCard('${user.facilityCode}', '${user.cardNumber}')">Delete</button>`;
             });
 
             // Add input row at the bottom of the table
@@ -61,47 +127,52 @@ function updateUserTable() {
 
             cellFacilityCode.innerHTML = '<input type="number" id="newFacilityCode">';
             cellCardNumber.innerHTML = '<input type="number" id="newCardNumber">';
-            cellName.innerHTML = '<input type="text" id="newName">';
+            cellName.innerHTML = '<input type="text" id="newName" maxlength="14">';
             cellAction.innerHTML = '<button onclick="addCard()">Save</button>';
         })
         .catch(error => console.error('Error fetching user data:', error));
 }
 
 function updateLastReadCardsTable() {
-    fetch('/getCards')
-        .then(response => response.json())
-        .then(data => {
-            lastReadCardsTableBody.innerHTML = '';
-            const last10Cards = data.slice(-10);
-            last10Cards.forEach((card, index) => {
-                let row = lastReadCardsTableBody.insertRow();
-                if (card.status === "Authorized") {
-                    row.classList.add("authorized");
-                } else if (card.status === "Unauthorized") {
-                    row.classList.add("unauthorized");
-                }
-                let cellIndex = row.insertCell(0);
-                let cellStatus = row.insertCell(1);
-                let cellDetails = row.insertCell(2);
+    lastReadCardsTableBody.innerHTML = '';
+    const last10Cards = cardData.slice(-10);
+    last10Cards.forEach((card, index) => {
+        let row = lastReadCardsTableBody.insertRow();
+        if (card.status === "Authorized") {
+            row.classList.add("authorized");
+        } else if (card.status === "Unauthorized") {
+            row.classList.add("unauthorized");
+        }
+        let cellIndex = row.insertCell(0);
+        let cellStatus = row.insertCell(1);
+        let cellDetails = row.insertCell(2);
 
-                cellIndex.innerHTML = index + 1;
-                cellStatus.innerHTML = card.status;
-                cellDetails.innerHTML = card.details;
-            });
+        cellIndex.innerHTML = index + 1;
+        cellStatus.innerHTML = card.status;
+        cellDetails.innerHTML = card.details;
+    });
 
-            // Add empty rows if there are less than 10 entries
-            for (let i = last10Cards.length; i < 10; i++) {
-                let row = lastReadCardsTableBody.insertRow();
-                let cellIndex = row.insertCell(0);
-                let cellStatus = row.insertCell(1);
-                let cellDetails = row.insertCell(2);
+    // Add empty rows if there are less than 10 entries
+    for (let i = last10Cards.length; i < 10; i++) {
+        let row = lastReadCardsTableBody.insertRow();
+        let cellIndex = row.insertCell(0);
+        let cellStatus = row.insertCell(1);
+        let cellDetails = row.insertCell(2);
 
-                cellIndex.innerHTML = i + 1;
-                cellStatus.innerHTML = "";
-                cellDetails.innerHTML = "";
-            }
-        })
-        .catch(error => console.error('Error fetching last read card data:', error));
+        cellIndex.innerHTML = i + 1;
+        cellStatus.innerHTML = "";
+        cellDetails.innerHTML = "";
+    }
+}
+
+// the device answers 503 while it saves pending credential changes
+function fetchChange(url, attempts = 5) {
+    return fetch(url).then(response => {
+        if (response.status === 503 && attempts > 1) {
+            return new Promise(resolve => setTimeout(resolve, 1000)).then(() => fetchChange(url, attempts - 1));
+        }
+        return response;
+    });
 }
 
 function addCard() {
@@ -109,7 +180,7 @@ function addCard() {
     const cardNumber = document.getElementById('newCardNumber').value;
     const name = document.getElementById('newName').value;
 
-    fetch(`/addCard?facilityCode=${facilityCode}&cardNumber=${cardNumber}&name=${name}`)
+    fetchChange(`/addCard?facilityCode=${facilityCode}&cardNumber=${cardNumber}&name=${name}`)
         .then(response => {
             if (response.ok) {
                 updateUserTable();
@@ -121,8 +192,8 @@ function addCard() {
         .catch(error => console.error('Error adding card:', error));
 }
 
-function deleteCard(index) {
-    fetch(`/deleteCard?index=${index}`)
+function deleteCard(facilityCode, cardNumber) {
+    fetchChange(`/deleteCard?facilityCode=${facilityCode}&cardNumber=${cardNumber}`)
         .then(response => {
             if (response.ok) {
                 updateUserTable();
@@ -159,6 +230,7 @@ function toggleWelcomeMessage() {
 function updateSettingsUI(settings) {
     document.getElementById('modeSelect').value = settings.mode;
     document.getElementById('timeoutSelect').value = settings.displayTimeout;
+    document.getElementById('frameGap').value = settings.frameGap;
     document.getElementById('ap_ssid').value = settings.apSsid;
     document.getElementById('ap_passphrase').value = settings.apPassphrase;
     document.getElementById('ssid_hidden').checked = settings.ssidHidden;
@@ -175,6 +247,7 @@ function updateSettingsUI(settings) {
 function saveSettings() {
     const mode = document.getElementById('modeSelect').value;
     const timeout = document.getElementById('timeoutSelect').value;
+    const frameGap = document.getElementById('frameGap').value;
     const apSsid = document.getElementById('ap_ssid').value;
     const apPassphrase = document.getElementById('ap_passphrase').value;
     const ssidHidden = document.getElementById('ssid_hidden').checked;
@@ -188,6 +261,7 @@ function saveSettings() {
     let settings = {
         mode: mode,
         displayTimeout: parseInt(timeout, 10),
+        frameGap: parseInt(frameGap, 10),
         apSsid: apSsid,
         apPassphrase: apPassphrase,
         ssidHidden: ssidHidden,
@@ -241,30 +315,42 @@ function exportData() {
 
 function importData() {
     const dataString = importExportArea.value;
-    try {
-        const data = JSON.parse(dataString);
-        if (Array.isArray(data)) {
-            data.forEach(card => {
-                const facilityCode = card.facilityCode;
-                const cardNumber = card.cardNumber;
-                const name = card.name;
-
-                fetch(`/addCard?facilityCode=${facilityCode}&cardNumber=${cardNumber}&name=${name}`)
-                    .then(response => {
-                        if (!response.ok) {
-                            throw new Error('Failed to add card');
-                        }
-                    })
-                    .catch(error => console.error('Error adding card:', error));
-            });
-            updateUserTable();
-            alert('Data imported successfully');
-        } else {
-            alert('Invalid data format');
-        }
-    } catch (error) {
-        alert('Invalid JSON format');
+    if (dataString.trim() === '') {
+        alert('Nothing to import');
+        return;
     }
+    // JSON or CSV (facilityCode,cardNumber,name), the device parses it
+    fetch('/importCredentials', {
+        method: 'POST',
+        headers: { 'Content-Type': 'text/plain' },
+        body: dataString
+    })
+        .then(response => {
+            if (!response.ok) {
+                return response.text().then(text => { throw new Error(text); });
+            }
+            return waitForImport();
+        })
+        .then(result => {
+            updateUserTable();
+            if (result.status !== 'done') {
+                throw new Error('nothing was stored');
+            }
+            alert(`Imported ${result.added} credentials, ${result.duplicate} duplicates, ${result.rejected} rejected`);
+        })
+        .catch(error => alert('Import failed: ' + error.message));
+}
+
+// the device merges a received import in the background
+function waitForImport() {
+    return fetch('/importStatus')
+        .then(response => response.json())
+        .then(result => {
+            if (result.status === 'merging') {
+                return new Promise(resolve => setTimeout(resolve, 500)).then(waitForImport);
+            }
+            return result;
+        });
 }
 
 function copyToClipboard(text) {
@@ -278,8 +364,34 @@ function copyToClipboard(text) {
     document.body.removeChild(tempInput);
 }
 
-setInterval(updateTable, 5000);
-setInterval(updateLastReadCardsTable, 5000);
-updateTable();
+// Reads and credential changes are pushed by the device. A read that does
+// not follow the last one seen means events were missed, /getCards fills
+// the gap.
+function connectEvents() {
+    const source = new EventSource('/events');
+    // catch up on what happened while the connection was down
+    source.onopen = () => {
+        updateCards();
+        updateUserTable();
+    };
+    source.addEventListener('card', event => {
+        const card = JSON.parse(event.data);
+        if (cardsLoading || card.sequence !== lastSequence + 1) {
+            updateCards();
+            return;
+        }
+        addCardRow(card, cardData.length);
+        cardData.push(card);
+        lastSequence = card.sequence;
+        updateLastReadCardsTable();
+    });
+    source.addEventListener('credentials', () => updateUserTable());
+}
+
+// a slow poll in case the event stream is unavailable, it costs a 304 when
+// nothing changed
+setInterval(updateCards, 30000);
+connectEvents();
+updateCards();
 updateUserTable();
 updateLastReadCardsTable();
\ No newline at end of file
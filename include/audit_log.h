@@ -0,0 +1,83 @@
+#ifndef AUDIT_LOG_H
+#define AUDIT_LOG_H
+
+#include "hal.h"
+#include "card_history.h"
+
+// bytes per segment file before the log rotates to the next one
+#define AUDIT_SEGMENT_SIZE 65536
+// segments kept, the oldest one is removed on rotation
+#define AUDIT_SEGMENTS 8
+// records buffered in RAM before they are written in one go
+#define AUDIT_BUFFER_RECORDS 16
+// longest time a buffered record waits for its write, in milliseconds
+#define AUDIT_FLUSH_INTERVAL 5000
+
+// Append-only log of every card read on flash. Records are CardRecords
+// written as they are, in segment files that rotate once they reach
+// AUDIT_SEGMENT_SIZE; segment n lives in slot n % AUDIT_SEGMENTS, so rotation
+// overwrites the oldest one.
+// Sequences and timestamps go on across reboots: the time is the capture
+// time plus the time of the last record found at boot, in microseconds.
+// The first sequence and time of every segment stay in RAM. Inside a segment
+// the records have a fixed size and are in order, so a range query seeks to
+// its start with a binary search and reads only the records it returns.
+// Appends are buffered: records reach flash in one write once
+// AUDIT_BUFFER_RECORDS are waiting, when the owner calls flush() (on idle
+// readers or once flushDue()), and before every query. A reset loses the
+// buffered records, at most AUDIT_BUFFER_RECORDS reads or AUDIT_FLUSH_INTERVAL
+// of them, and the log goes on from the last record written.
+// The methods are for one caller at a time.
+class AuditLog
+{
+public:
+    // loads the segment index and opens the newest segment for appending
+    bool begin(fs::FS &fs, const char *path);
+    // buffers a copy of the read under the next sequence, returns the
+    // sequence or 0 when the log cannot take it
+    uint32_t append(const CardRecord &record);
+    // writes the buffered records, false when they were lost
+    bool flush();
+    bool buffered() const;
+    // true once the oldest buffered record waited AUDIT_FLUSH_INTERVAL
+    bool flushDue() const;
+    // reads up to count consecutive records from sequence on, starting at the
+    // oldest one when sequence was rotated out; returns the records read
+    size_t read(uint32_t sequence, CardRecord *records, size_t count);
+    // first sequence logged at or after time, nextSequence() when none is
+    uint32_t findTime(int64_t time);
+    // sequence of the oldest record still held
+    uint32_t firstSequence() const;
+    uint32_t nextSequence() const;
+
+private:
+    struct Segment
+    {
+        uint32_t number;
+        uint32_t firstSequence;
+        uint32_t count;
+        int64_t firstTime;
+        bool valid;
+    };
+
+    String slotPath(uint32_t slot) const;
+    Segment *segment(uint32_t number);
+    // reads the header and the bounds of the segment file in slot
+    bool loadSegment(uint32_t slot, int64_t &lastTime);
+    // replaces the oldest segment with an empty one holding number
+    bool startSegment(uint32_t number);
+    bool readRecord(File &in, uint32_t index, CardRecord &record);
+
+    fs::FS *fs = nullptr;
+    const char *path = nullptr;
+    File file;
+    Segment segments[AUDIT_SEGMENTS] = {};
+    uint32_t newest = 0;
+    uint32_t next = 1;
+    int64_t clockOffset = 0;
+    CardRecord buffer[AUDIT_BUFFER_RECORDS];
+    uint32_t bufferCount = 0;
+    unsigned long bufferTime = 0; // millis() of the oldest buffered record
+};
+
+#endif // AUDIT_LOG_H
@@ -0,0 +1,34 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include "hal.h"
+
+// bits of filter per key, 8 bits with 5 probes gives about 2% false positives
+#define BLOOM_BITS_PER_KEY 8
+#define BLOOM_PROBES 5
+
+// Bloom filter over 64-bit key hashes. A negative answer is exact, a positive
+// one has to be confirmed against the real data.
+class BloomFilter
+{
+public:
+    ~BloomFilter();
+    // sizes the filter for keys entries, returns false when out of memory
+    bool begin(size_t keys);
+    void clear();
+    void add(uint64_t keyHash);
+    bool mayContain(uint64_t keyHash) const;
+    size_t sizeBytes() const;
+    // the bits, sizeBytes() long, for storing a filter and loading it back
+    // into one begun for as many keys
+    uint8_t *data();
+    const uint8_t *data() const;
+    // takes over the bits of other, leaving it empty
+    void swap(BloomFilter &other);
+
+private:
+    uint32_t *bits = nullptr;
+    uint32_t bitCount = 0;
+};
+
+#endif // BLOOM_FILTER_H
@@ -0,0 +1,19 @@
+#ifndef CARD_DECODER_H
+#define CARD_DECODER_H
+
+#include "hal.h"
+#include "doorsim.h"
+#include "credential_store.h"
+
+// Decodes the frame and makes the access decision with a lock free lookup in
+// store. Runs on the decision task, so it must not touch Serial, the LCD or
+// anything else slow.
+void decideCard(CardEvent &event, CredentialStore &store);
+// hex and raw bits of a stored read, hex holds CARD_HEX_SIZE and raw
+// MAX_BITS + 1 chars
+void formatCardRecord(const CardRecord &record, char *hex, char *raw);
+// a read as the dashboards get it from /getCards and /events
+void cardRecordToJson(const CardRecord &record, JsonObject card);
+void credentialToJson(const Credential &credential, JsonObject user);
+
+#endif // CARD_DECODER_H
@@ -0,0 +1,71 @@
+#ifndef CARD_FORMATS_H
+#define CARD_FORMATS_H
+
+#include "hal.h"
+#include "wiegand.h"
+
+// max number of parity bits a format can define
+#define MAX_PARITY_CHECKS 3
+// size of the buffer needed by formatCardHex()
+#define CARD_HEX_SIZE (MAX_BITS / 4 + 2)
+
+// A field of the frame, start is the index of its most significant bit.
+// Fields are up to 64 bits, a length of 0 means the format has no such field.
+struct BitField
+{
+    uint8_t start;
+    uint8_t length;
+};
+
+// A parity bit and the bits it covers, the parity bit itself is part of mask
+struct ParityCheck
+{
+    uint32_t mask[FRAME_WORDS];
+    uint8_t bit;
+    bool odd;
+};
+
+// How the hex value of a card is shown
+enum HexLayout : uint8_t
+{
+    // HID 10 char value: frame below a sentinel bit, plus the preamble bit 37
+    HEX_HID,
+    // the frame as is, zero padded to a whole number of nibbles
+    HEX_RAW,
+};
+
+struct CardFormat
+{
+    const char *name;
+    uint8_t bitCount;
+    BitField facilityCode;
+    BitField cardNumber;
+    uint8_t parityCount;
+    ParityCheck parity[MAX_PARITY_CHECKS];
+    HexLayout hexLayout;
+};
+
+// marks a frame without a known format in a stored format id
+#define NO_CARD_FORMAT 0xFF
+
+// First registered format of a frame length, nullptr when the length is not
+// supported
+const CardFormat *findCardFormat(unsigned int bitCount);
+// compact id of a format for stored records, NO_CARD_FORMAT for nullptr
+uint8_t cardFormatId(const CardFormat *format);
+// format of a stored id, nullptr when it is NO_CARD_FORMAT or out of range
+const CardFormat *cardFormatById(uint8_t id);
+// true when the frame passes every parity check of the format
+bool checkParity(const WiegandFrame &frame, const CardFormat &format);
+// Scores every format of the frame length and returns the best one, preferring
+// formats whose parity passes; nullptr when the length is not supported
+const CardFormat *detectCardFormat(const WiegandFrame &frame, bool &parityValid);
+uint64_t decodeFacilityCode(const WiegandFrame &frame, const CardFormat &format);
+uint64_t decodeCardNumber(const WiegandFrame &frame, const CardFormat &format);
+// writes the hex value of the frame to out, which holds CARD_HEX_SIZE chars
+void formatCardHex(const WiegandFrame &frame, const CardFormat &format, char *out);
+// Builds the frame of a card in the format, with the fields cut to their
+// length and every parity check passing; for the host benchmarks and tools
+void encodeCardFrame(const CardFormat &format, uint64_t facilityCode, uint64_t cardNumber, WiegandFrame &frame);
+
+#endif // CARD_FORMATS_H
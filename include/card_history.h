@@ -0,0 +1,153 @@
+#ifndef CARD_HISTORY_H
+#define CARD_HISTORY_H
+
+#include "hal.h"
+#include <atomic>
+#include "wiegand.h"
+#include "card_formats.h"
+
+// bytes of encoded reads per block, the oldest block is dropped as a whole
+#define CARD_HISTORY_BLOCK_SIZE 2048
+// 32 KB of RAM, about 6000 reads of repeated cards or 4200 of distinct ones
+#ifndef CARD_HISTORY_BLOCKS
+#define CARD_HISTORY_BLOCKS 16
+#endif
+// distinct cards a block can refer back to, later ones are stored again
+#define CARD_HISTORY_DICTIONARY 64
+// facility codes a block can refer back to, later ones start no new entry
+#define CARD_HISTORY_FACILITIES 16
+
+enum CardStatus : uint8_t
+{
+    CARD_READ,
+    CARD_AUTHORIZED,
+    CARD_UNAUTHORIZED,
+    CARD_PARITY_ERROR,
+};
+
+// One card read as handed to and returned by the history
+struct CardRecord
+{
+    uint32_t sequence;  // increases by one for every read, starts at 1
+    uint8_t bitCount;   // received bits, clamped to MAX_BITS
+    uint8_t formatId;   // cardFormatId() of the detected format
+    CardStatus status;
+    char name[15];      // matched credential when CARD_AUTHORIZED
+    uint8_t reader;     // ReaderChannel::id() of the reader, 0 when unknown
+    int64_t timestamp;  // esp_timer_get_time() of the read, in microseconds
+    uint64_t facilityCode;
+    uint64_t cardNumber;
+    uint32_t bits[FRAME_WORDS]; // frame packed like WiegandFrame::words
+
+    void setFrame(const WiegandFrame &frame);
+    void getFrame(WiegandFrame &frame) const;
+};
+
+const char *cardStatusName(CardStatus status);
+
+// Compressed history of the latest reads. Records are encoded into a ring of
+// fixed-size blocks, each starting with a full timestamp so it decodes on its
+// own:
+//   tag      status, and either a new card or the index of a card already
+//            stored in the same block
+//   varint   milliseconds since the previous read of the block
+//   literal  only for a card not seen yet on that reader in the block, one of
+//            - a facility: format, reader, facility code and card number,
+//              for a card of a known format the block has no entry for yet
+//            - a member: index of a facility of the block and the card
+//              number as a difference to the first one of that facility
+//            - a frame: bit count, format, reader and the frame bits packed
+//              into bytes, for any frame the fields do not rebuild exactly
+//            plus the name for an authorized card
+// Facility and member literals are rebuilt into frames by encodeCardFrame(),
+// frame literals have their codes decoded again, and timestamps come back
+// rounded to the millisecond. A repeated card takes three to five bytes and a
+// new one of a known facility about seven, instead of sizeof(CardRecord).
+//
+// One task adds records while others decode them: a block carries the sequence
+// of its first record, which a reader checks after every decoded record, so a
+// block being reused is noticed instead of returning garbage.
+class CardHistory
+{
+    struct Block;
+
+public:
+    // Sequential decoder, records come out in sequence order. Skips records
+    // that were dropped while it was reading.
+    class Cursor
+    {
+    public:
+        Cursor(const CardHistory &history, uint32_t from);
+        // decodes the next record, false when no newer one exists yet
+        bool next(CardRecord &record);
+
+    private:
+        // positions the cursor on the block holding sequence
+        bool seek();
+        bool decode(const Block &block, CardRecord &record);
+
+        const CardHistory &history;
+        uint32_t sequence;
+        int block = -1;
+        uint32_t blockFirst = 0;
+        uint16_t index = 0;
+        uint16_t offset = 0;
+        int64_t time = 0;
+        uint16_t literals[CARD_HISTORY_DICTIONARY];
+        uint8_t literalCount = 0;
+        uint16_t facilities[CARD_HISTORY_FACILITIES];
+        uint8_t facilityCount = 0;
+    };
+
+    // stores the record under the next sequence number and returns it
+    uint32_t add(CardRecord &record);
+    // decodes the record with that sequence, false when it was dropped or
+    // does not exist yet; use a Cursor to walk the history
+    bool get(uint32_t sequence, CardRecord &record) const;
+    // sequence of the oldest record still held, equal to nextSequence() when
+    // the history is empty
+    uint32_t firstSequence() const;
+    uint32_t nextSequence() const;
+    size_t memoryUsage() const;
+
+private:
+    struct Block
+    {
+        // sequence of the first record, 0 while the block is empty or reused
+        std::atomic<uint32_t> first{0};
+        std::atomic<uint16_t> count{0};
+        int64_t baseTime = 0; // milliseconds
+        uint8_t data[CARD_HISTORY_BLOCK_SIZE];
+    };
+
+    // a facility literal of the block being filled
+    struct Facility
+    {
+        uint8_t formatId;
+        uint8_t reader;
+        uint64_t code;
+        uint64_t firstCard;
+    };
+
+    // drops the oldest block to make room for records from sequence on
+    void startBlock(uint32_t sequence, int64_t time);
+    // encodes the card of a record as a literal for the block being filled
+    size_t encodeLiteral(const CardRecord &record, uint8_t *out) const;
+    // encodes a record for the block being filled; literalOffset is where a
+    // new card starts in out, 0 for a repeated one
+    size_t encode(const CardRecord &record, int64_t time, uint8_t *out, size_t &literalOffset) const;
+
+    Block blocks[CARD_HISTORY_BLOCKS];
+    std::atomic<uint32_t> next{1};
+
+    // encoder state of the block being filled, only used by add()
+    int tail = -1;
+    uint16_t used = 0;
+    int64_t lastTime = 0;
+    uint16_t literals[CARD_HISTORY_DICTIONARY];
+    uint8_t literalCount = 0;
+    Facility facilities[CARD_HISTORY_FACILITIES];
+    uint8_t facilityCount = 0;
+};
+
+#endif // CARD_HISTORY_H
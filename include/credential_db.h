@@ -0,0 +1,108 @@
+#ifndef CREDENTIAL_DB_H
+#define CREDENTIAL_DB_H
+
+#include "hal.h"
+#include "doorsim.h"
+#include "bloom_filter.h"
+
+// records per sparse index entry, one block is 2KB of flash
+#define CREDENTIAL_DB_STRIDE 64
+
+// Changes for CredentialDb::merge(), handed out in key order
+class CredentialSource
+{
+public:
+    virtual ~CredentialSource() {}
+    // false once every change has been handed out
+    virtual bool next(Credential &credential) = 0;
+    // true when next() stopped on an error, the merge is then dropped
+    virtual bool failed() const
+    {
+        return false;
+    }
+};
+
+// RAM side of one database generation: the Bloom filter, the sparse index and
+// the file holding the records. It never changes once loaded, so readers
+// outside the writer lock can keep using it while the next generation is
+// written to the other file.
+class CredentialImage
+{
+public:
+    ~CredentialImage();
+    size_t count() const;
+    // false means the key is surely not in the file
+    bool mayContain(uint64_t facilityCode, uint64_t cardNumber) const;
+    // lookups go through a read handle on path() owned by the caller
+    bool find(File &in, uint64_t facilityCode, uint64_t cardNumber, Credential &credential) const;
+    // credential at a position in key order
+    bool read(File &in, size_t index, Credential &credential) const;
+    // position of the first credential whose key is not below the key
+    size_t lowerBound(File &in, uint64_t facilityCode, uint64_t cardNumber) const;
+    const char *path() const;
+    size_t memoryUsage() const;
+
+private:
+    friend class CredentialDb;
+
+    struct Key
+    {
+        uint64_t facilityCode;
+        uint64_t cardNumber;
+    };
+
+    String filePath;
+    uint32_t generation = 0;
+    size_t dataOffset = 0;
+    size_t recordCount = 0;
+    BloomFilter bloom;
+    Key *sparse = nullptr;
+    size_t sparseCount = 0;
+};
+
+// Sorted credential file on flash. A Bloom filter answers most negative
+// lookups from RAM, a sparse index of every CREDENTIAL_DB_STRIDE-th key
+// narrows positive lookups down to a binary search inside one block.
+// Generations alternate between two files, so a merge never touches the file
+// a reader may still have open; the older one is removed by release(). The
+// filter and the sparse index of a generation are stored next to it as a boot
+// snapshot, <file>.idx, so they load without a scan of the records.
+class CredentialDb
+{
+public:
+    ~CredentialDb();
+    // opens the newest generation or creates the file, and builds the filter
+    // and sparse index
+    bool begin(fs::FS &fs, const char *path);
+    void end();
+    size_t count() const;
+    bool mayContain(uint64_t facilityCode, uint64_t cardNumber) const;
+    bool find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential);
+    bool read(size_t index, Credential &credential);
+    size_t lowerBound(uint64_t facilityCode, uint64_t cardNumber);
+    // Writes the next generation as the merge of the records and changes.
+    // changes must be sorted by key; entries flagged CREDENTIAL_DELETED
+    // remove the key. Fails while the previous generation is not released.
+    bool merge(const Credential *changes, size_t changeCount);
+    bool merge(CredentialSource &changes);
+    // the current generation
+    const CredentialImage *image() const;
+    // frees the generation replaced by the last merge and removes its file,
+    // the caller makes sure no reader uses it any more
+    void release();
+    size_t memoryUsage() const;
+
+private:
+    String slotPath(uint32_t generation) const;
+    CredentialImage *load(const String &filePath);
+    bool loadIndex(CredentialImage &image);
+    void saveIndex(const CredentialImage &image);
+
+    fs::FS *fs = nullptr;
+    const char *path = nullptr;
+    File file;
+    CredentialImage *current = nullptr;
+    CredentialImage *retired = nullptr;
+};
+
+#endif // CREDENTIAL_DB_H
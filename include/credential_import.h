@@ -0,0 +1,72 @@
+#ifndef CREDENTIAL_IMPORT_H
+#define CREDENTIAL_IMPORT_H
+
+#include "hal.h"
+#include "credential_store.h"
+
+// longest JSON object or CSV line accepted for one credential
+#define IMPORT_RECORD_SIZE 192
+
+// Streaming credential import. The body is fed in chunks as it arrives and
+// can be CSV (facilityCode,cardNumber,name per line, optional header) or JSON.
+// JSON credentials are the {facilityCode, cardNumber, name} objects of a
+// top-level array, or of the "users" array of an object as /exportData sends
+// it ("credentials" in the legacy credentials.json); other members, like the
+// "cards" of an export, are skipped. Only one record is buffered at a time.
+// The body is parsed as it arrives; finish() then stores the import as one
+// transaction, see CredentialStore::beginBatch().
+class CredentialImporter
+{
+public:
+    bool begin(CredentialStore &store);
+    void feed(const uint8_t *data, size_t len);
+    // the body is complete, parses what is left of it
+    void endInput();
+    // merges the batch into the database, a rewrite of the whole database;
+    // false when storing failed and nothing was imported
+    bool finish();
+    void abort();
+    bool active() const;
+
+    size_t added = 0;
+    size_t duplicate = 0;
+    size_t rejected = 0;
+
+private:
+    enum Format
+    {
+        UNKNOWN,
+        CSV,
+        JSON,
+    };
+
+    void feedCsv(char c);
+    void feedJson(char c);
+    void append(char c);
+    // true when the key before an array of the top-level object names the
+    // credentials
+    bool credentialMember() const;
+    void importCsvLine();
+    void importJsonObject();
+    void importRecord(const char *facilityCode, const char *cardNumber, const char *name);
+
+    CredentialStore *store = nullptr;
+    Format format = UNKNOWN;
+    char record[IMPORT_RECORD_SIZE];
+    size_t length = 0;
+    bool overflow = false;
+    bool firstLine = true;
+    // JSON scanner state
+    unsigned int depth = 0;
+    // depth of the array holding the credentials, 0 outside of it
+    unsigned int listDepth = 0;
+    bool topObject = false;
+    bool inCredential = false;
+    bool inString = false;
+    bool escaped = false;
+    // last string of the top-level object, the key of the next value
+    char key[16];
+    size_t keyLength = 0;
+};
+
+#endif // CREDENTIAL_IMPORT_H
@@ -0,0 +1,48 @@
+#ifndef CREDENTIAL_INDEX_H
+#define CREDENTIAL_INDEX_H
+
+#include "hal.h"
+#include "doorsim.h"
+
+// 64-bit hash of a credential key
+uint64_t credentialHash(uint64_t facilityCode, uint64_t cardNumber);
+
+// Open-addressing hash index over a credential table, keyed on the full
+// (facilityCode, cardNumber) pair. Buckets hold the key hash and the slot of
+// the credential in the table; linear probing with backward-shift deletion
+// keeps lookups short without tombstones.
+class CredentialIndex
+{
+public:
+    ~CredentialIndex();
+    // sizes the index for capacity credentials, returns false when out of memory
+    bool begin(size_t capacity);
+    void clear();
+    // slot of the credential in table, -1 when it is not indexed
+    int32_t find(uint64_t facilityCode, uint64_t cardNumber, const Credential *table) const;
+    // adds a credential, the key must not be indexed yet
+    void insert(uint64_t facilityCode, uint64_t cardNumber, uint32_t slot);
+    // points an indexed key to a new slot after the table was reordered
+    void move(uint64_t facilityCode, uint64_t cardNumber, uint32_t from, uint32_t to);
+    void remove(uint64_t facilityCode, uint64_t cardNumber, uint32_t slot);
+
+    static uint32_t hash(uint64_t facilityCode, uint64_t cardNumber)
+    {
+        return (uint32_t)credentialHash(facilityCode, cardNumber);
+    }
+
+private:
+    struct Bucket
+    {
+        uint32_t hash;
+        uint32_t slot;
+    };
+
+    // bucket holding slot for the key, -1 when not found
+    int32_t findBucket(uint32_t keyHash, uint32_t slot) const;
+
+    Bucket *buckets = nullptr;
+    uint32_t mask = 0;
+};
+
+#endif // CREDENTIAL_INDEX_H
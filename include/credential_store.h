@@ -0,0 +1,127 @@
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include "hal.h"
+#include "doorsim.h"
+#include "credential_db.h"
+#include "credential_index.h"
+#include "credential_table.h"
+#include <atomic>
+
+// credential changes held in RAM before they are merged into the database
+#define MAX_PENDING_CREDENTIALS 256
+// pending changes from which compaction runs as soon as the device is idle
+#define CREDENTIAL_COMPACT_THRESHOLD 64
+// credentials collected by a batch in RAM before they are sorted and spilled
+// to the run file as one run
+#define CREDENTIAL_BATCH_SIZE 1024
+// runs a batch can spill, more than the flash holds credentials for
+#define CREDENTIAL_MAX_RUNS 64
+// records read from the run file at a time for each run while merging
+#define CREDENTIAL_RUN_BUFFER 8
+
+enum BatchResult
+{
+    BATCH_ADDED,
+    BATCH_DUPLICATE,
+    BATCH_FAILED,
+};
+
+// Credentials as the sorted flash database plus the changes not merged into
+// it yet. Pending changes are hash indexed and shadow the database, a pending
+// entry flagged CREDENTIAL_DELETED hides the stored credential.
+// Every change is appended to a journal file first, so it costs one record
+// written to flash; compaction merges the journal into a new database
+// snapshot and truncates it. At boot the journal is replayed on top of the
+// snapshot.
+// The methods above are for a single writer at a time. lookup() is the lock
+// free read side: every change publishes a new immutable CredentialTable
+// with an atomic pointer swap, and the old one is freed once no lookup is
+// still running on it.
+class CredentialStore
+{
+public:
+    bool begin(fs::FS &fs, const char *path, const char *journalPath);
+    bool find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential);
+    // Never blocks and sees every change either entirely or not at all. Only
+    // one task may call it, tables read the database through one file handle.
+    bool lookup(uint64_t facilityCode, uint64_t cardNumber, Credential &credential);
+    // false when the credential already exists or cannot be stored, which
+    // includes a full pending table
+    bool add(uint64_t facilityCode, uint64_t cardNumber, const char *name);
+    // false when the credential does not exist or the pending table is full
+    bool remove(uint64_t facilityCode, uint64_t cardNumber);
+    // merges the pending changes into the database and truncates the journal
+    bool commit();
+    // true when enough changes are pending to be worth a compaction
+    bool compactionDue() const;
+    // true when a change could not be published to lookup(), which then
+    // still answers from the table before it; see republish()
+    bool publishDue() const;
+    // retries the failed publish, commit() and endBatch() do it first too
+    bool republish();
+    // true when no change fits until commit() has run; add() and remove()
+    // never compact themselves, that would rewrite the database in the
+    // caller's task
+    bool pendingFull() const;
+
+    // Bulk loading as one transaction: credentials added to a batch skip the
+    // journal, every CREDENTIAL_BATCH_SIZE of them are sorted and spilled to
+    // a run file next to the journal. endBatch() merges the runs and the
+    // pending changes into the database in one rewrite; until then nothing
+    // of the batch is visible or persisted, and abortBatch() or a reboot
+    // drops it. endBatch() rewrites the whole database, call it from a task
+    // that may block, not from the web server.
+    bool beginBatch();
+    BatchResult batchAdd(uint64_t facilityCode, uint64_t cardNumber, const char *name);
+    bool endBatch();
+    void abortBatch();
+    bool batchOpen() const;
+    // credentials added twice within the batch, counted when they are merged
+    size_t batchDuplicates() const;
+    size_t count() const;
+    size_t pendingCount() const;
+    size_t memoryUsage() const;
+
+    // Copies up to count credentials in key order into credentials, starting
+    // after the key of after, or at the first one when after is null.
+    // Returns the credentials copied, fewer than count at the end. Paging by
+    // key keeps a listing consistent when the store changes in between.
+    size_t list(const Credential *after, Credential *credentials, size_t count);
+
+private:
+    bool makeRoom();
+    // records a change in the pending table, which must have room for it
+    void put(uint64_t facilityCode, uint64_t cardNumber, const char *name, uint8_t flags);
+    bool append(uint64_t facilityCode, uint64_t cardNumber, const char *name, uint8_t flags);
+    void replayJournal();
+    bool resetJournal();
+    bool spillBatch();
+    String runPath() const;
+    // false leaves lookup() on the previous table and marks publishDue()
+    bool publish();
+
+    fs::FS *fs = nullptr;
+    const char *journalPath = nullptr;
+    File journal;
+    bool replaying = false;
+    CredentialDb db;
+    CredentialIndex index;
+    Credential pending[MAX_PENDING_CREDENTIALS];
+    size_t pendingUsed = 0;
+    size_t total = 0;
+    Credential *batch = nullptr;
+    size_t batchUsed = 0;
+    File run;
+    // record offsets of the runs in the run file, runStarts[runCount] is
+    // the end of the last one
+    size_t runStarts[CREDENTIAL_MAX_RUNS + 1];
+    size_t runCount = 0;
+    size_t duplicates = 0;
+    std::atomic<CredentialTable *> table{nullptr};
+    bool unpublished = false;
+    // lookups in progress, a replaced table is freed when this drops to 0
+    std::atomic<uint32_t> readers{0};
+};
+
+#endif // CREDENTIAL_STORE_H
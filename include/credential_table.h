@@ -0,0 +1,33 @@
+#ifndef CREDENTIAL_TABLE_H
+#define CREDENTIAL_TABLE_H
+
+#include "hal.h"
+#include "doorsim.h"
+#include "credential_db.h"
+#include "credential_index.h"
+
+// Immutable snapshot of the credentials: a copy of the pending changes of the
+// store on top of one database generation. The store builds a new table off
+// to the side for every change and publishes it with a pointer swap, so a
+// reader always sees one consistent version.
+class CredentialTable
+{
+public:
+    ~CredentialTable();
+    // copies changes and opens a read handle on the image file, false when
+    // out of memory
+    bool begin(fs::FS &fs, const CredentialImage &image, const Credential *changes, size_t changeCount);
+    // the read handle makes lookups single reader
+    bool find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential);
+    // RAM of the copied changes, the image belongs to the database
+    size_t memoryUsage() const;
+
+private:
+    const CredentialImage *image = nullptr;
+    File file;
+    Credential *changes = nullptr;
+    size_t changeCount = 0;
+    CredentialIndex index;
+};
+
+#endif // CREDENTIAL_TABLE_H
@@ -1,54 +1,182 @@
 #ifndef DOORSIM_H
 #define DOORSIM_H
 
-#include <Arduino.h>
+#include "hal.h"
+#include "wiegand.h"
+#include "card_formats.h"
+#include "card_history.h"
+#include <ArduinoJson.h>
+#include "json_stream.h"
 
-// Structs
-struct CardData
+class AsyncWebServerRequest;
+class AsyncWebServerResponse;
+struct SettingsSnapshot;
+
+// set on a credential that records a deletion
+#define CREDENTIAL_DELETED 0x01
+
+// Also the on-flash record of the credential database, keep it 32 bytes
+struct Credential
 {
-    unsigned int bitCount;
-    unsigned long facilityCode;
-    unsigned long cardNumber;
-    String hexCardData;
-    String rawCardData;
-    String status;
-    String details;
+    uint64_t facilityCode;
+    uint64_t cardNumber;
+    char name[15]; // 14 chars fit on the LCD after "Name: "
+    uint8_t flags;
 };
 
-struct Credential
+static_assert(sizeof(Credential) == 32, "Credential is stored on flash as a 32 byte record");
+
+// credentials are ordered by facility code, then card number
+inline bool credentialKeyLess(uint64_t fc1, uint64_t cn1, uint64_t fc2, uint64_t cn2)
+{
+    return fc1 < fc2 || (fc1 == fc2 && cn1 < cn2);
+}
+
+// Outcome of the access decision for a frame
+enum AccessResult : uint8_t
+{
+    ACCESS_UNKNOWN_FORMAT,
+    ACCESS_PARITY_ERROR,
+    ACCESS_GRANTED,
+    ACCESS_DENIED,
+};
+
+// audit log records read per file access by a query
+#define AUDIT_QUERY_BATCH 8
+
+// Range of the audit log being streamed by /getAuditLog: the records from
+// sequence on, below endSequence and endTime
+struct AuditQuery
+{
+    uint32_t sequence;
+    uint32_t endSequence;
+    int64_t endTime;
+    CardRecord batch[AUDIT_QUERY_BATCH];
+    size_t batchSize;
+    size_t batchIndex;
+};
+
+// credentials read per list() call of a listing
+#define CREDENTIAL_LIST_BATCH 8
+
+// Credentials being streamed by /getUsers and /exportData; each batch is
+// listed after the last credential of the previous one
+struct CredentialListing
+{
+    Credential batch[CREDENTIAL_LIST_BATCH];
+    size_t batchSize;
+    size_t batchIndex;
+    bool done;
+};
+
+// bulk import on /importCredentials
+enum ImportState : uint8_t
+{
+    IMPORT_IDLE,
+    IMPORT_RECEIVING, // the web server parses the body
+    IMPORT_MERGING,   // the storage task merges it into the database
+    IMPORT_DONE,
+    IMPORT_FAILED,
+};
+
+enum LiveEventType : uint8_t
+{
+    LIVE_CARD,
+    LIVE_CREDENTIAL_ADDED,
+    LIVE_CREDENTIAL_DELETED,
+    LIVE_CREDENTIALS_IMPORTED,
+    // changes were dropped, the dashboards load the credentials again
+    LIVE_CREDENTIALS_CHANGED,
+};
+
+// Something the dashboards are told about as it happens, queued for the
+// events task
+struct LiveEvent
+{
+    LiveEventType type;
+    uint32_t latency;  // decision latency of a read, in microseconds
+    uint32_t count;    // credentials added by an import
+    CardRecord record; // LIVE_CARD
+    Credential credential;
+};
+
+// A frame on its way through the pipeline: filled in by the capture task,
+// decided by the decision task and acted upon by the effects task
+struct CardEvent
 {
-    unsigned long facilityCode;
-    unsigned long cardNumber;
-    char name[50];
+    WiegandFrame frame;
+    uint8_t reader;       // ReaderChannel::id() of the reader
+    int64_t captureTime;  // esp_timer_get_time() when the frame was complete
+    int64_t decisionTime; // esp_timer_get_time() when the decision was made
+    const CardFormat *format;
+    bool parityValid;
+    AccessResult result;
+    uint64_t facilityCode;
+    uint64_t cardNumber;
+    Credential credential; // the matched credential when ACCESS_GRANTED
 };
 
 
-void ISR_INT0();
-void ISR_INT1();
+unsigned long clampFrameGap(int64_t gap);
+bool readWiegandEdges(ReaderChannel &reader);
+bool readersIdle();
+void settingsToSnapshot(SettingsSnapshot &settings);
+void settingsFromSnapshot(const SettingsSnapshot &settings);
+bool exportSettingsJson();
+bool importSettingsJson();
 void saveSettingsToPreferences();
 void loadSettingsFromPreferences();
 void saveCredentialsToPreferences();
+void migrateCredentialsFromJson();
 void loadCredentialsFromPreferences();
-const Credential *checkCredential(uint16_t fc, uint16_t cn);
+void lockCredentials();
+bool tryLockCredentials();
+void unlockCredentials();
+void loadAuditLog();
+void lockAudit();
+void unlockAudit();
+bool nextAuditRecord(AuditQuery &query, CardRecord &record);
+bool checkCredential(uint64_t fc, uint64_t cn, Credential &credential);
+void captureTask(void *arg);
+void decisionTask(void *arg);
+void effectsTask(void *arg);
+void storageTask(void *arg);
+void eventsTask(void *arg);
+void startPipeline();
+void queueCredentialEvent(LiveEventType type, uint64_t facilityCode, uint64_t cardNumber, const char *name, uint32_t count);
+void sendLiveEvent(const LiveEvent &event);
+void reportDroppedEdges();
 void ledOnValid();
 void speakerOnValid();
+void relayOnValid();
+void updateOutputs();
 void lcdInvalidCredentials();
+void lcdParityError();
 void speakerOnFailure();
-void printCardData();
-unsigned long decodeHIDFacilityCode(unsigned int start, unsigned int end);
-unsigned long decodeHIDCardNumber(unsigned int start, unsigned int end);
-void setCardChunkBits(unsigned int cardChunk1Offset, unsigned int bitHolderOffset, unsigned int cardChunk2Offset);
-String prefixPad(const String &in, const char c, const size_t len);
-void processHIDCard();
-void processCardData();
-void clearDatabits();
+void printCardData(const CardEvent &event);
+void processHIDCard(const CardEvent &event);
+void processCardData(const CardEvent &event);
+void handleCardEvent(const CardEvent &event);
 void cleanupCardData();
-bool allBitsAreOnes();
 String centerText(const String &text, int width);
 void printWelcomeMessage();
 void updateDisplay();
+uint32_t latestCardSequence(uint32_t count);
 void printAllCardData();
+bool nextListedCredential(CredentialListing &listing, Credential &credential);
+JsonElementSource cardSource(uint32_t from, uint32_t end);
+JsonElementSource userSource();
+AsyncWebServerResponse *beginJsonStream(AsyncWebServerRequest *request, JsonStream *stream, bool credentials = false);
+void sendJsonStream(AsyncWebServerRequest *request, JsonStream *stream, bool credentials = false);
+void sendIndex(AsyncWebServerRequest *request);
+void sendCards(AsyncWebServerRequest *request);
+void sendCompacting(AsyncWebServerRequest *request);
+void refuseImport(AsyncWebServerRequest *request, int status, const char *reason);
+void dropImport();
+void finishImport();
+void sendImportStatus(AsyncWebServerRequest *request, int status);
 void setupWifi();
 void webServer();
+void reportBootStage(const char *stage, int64_t &stageStart);
 
 #endif // DOORSIM_H
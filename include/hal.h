@@ -0,0 +1,18 @@
+#ifndef HAL_H
+#define HAL_H
+
+// What the modules without hardware state take from the platform: String,
+// fs::FS and File, the clocks (millis(), micros(), esp_timer_get_time()),
+// IRAM_ATTR, min() and max(). On the device these come from the Arduino core,
+// the native build supplies them from hal_native.h, so the decoding,
+// credential and history code runs and is timed on the host as it is.
+// Anything touching pins, the LCD, WiFi or FreeRTOS stays in main.cpp.
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <FS.h>
+#include "esp_timer.h"
+#else
+#include "hal_native.h"
+#endif
+
+#endif // HAL_H
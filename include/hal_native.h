@@ -0,0 +1,124 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+// Host stand-ins for the parts of the Arduino core listed in hal.h, only
+// built by env:native. They follow the Arduino API closely enough for the
+// shared modules and nothing more.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#define IRAM_ATTR
+
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+int64_t esp_timer_get_time();
+uint32_t esp_random();
+void delay(unsigned long ms);
+
+// The Arduino String subset the modules use. write() lets ArduinoJson
+// serialize into it like into any other Print-like destination.
+class String
+{
+public:
+    String() {}
+    String(const char *text);
+    String(char c);
+    String(int value);
+    String(unsigned int value);
+    String(long value);
+    String(unsigned long value);
+    String(long long value);
+    String(unsigned long long value);
+
+    size_t length() const;
+    const char *c_str() const;
+    bool reserve(size_t size);
+    bool concat(const char *text);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *data, size_t size);
+    char operator[](size_t index) const;
+    String &operator+=(const String &other);
+    String &operator+=(const char *text);
+    String &operator+=(char c);
+    bool operator==(const String &other) const;
+    bool operator==(const char *text) const;
+    bool operator!=(const String &other) const;
+
+private:
+    std::string text;
+};
+
+String operator+(const String &left, const String &right);
+String operator+(const String &left, const char *right);
+String operator+(const char *left, const String &right);
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet,
+    SeekCur,
+    SeekEnd,
+};
+
+// A file of the host file system, shared by its copies like a LittleFS
+// File and closed with the last one
+class File
+{
+public:
+    File() {}
+    explicit File(FILE *handle);
+
+    explicit operator bool() const;
+    size_t read(uint8_t *buffer, size_t size);
+    int read();
+    int available();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *data, size_t size);
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void flush();
+    void close();
+
+private:
+    std::shared_ptr<FILE> handle;
+};
+
+// A directory of the host standing in for the flash file system: paths
+// like "/credentials.db" are resolved below root
+class FS
+{
+public:
+    explicit FS(const char *root);
+
+    File open(const char *path, const char *mode = "r");
+    File open(const String &path, const char *mode = "r");
+    bool exists(const char *path);
+    bool exists(const String &path);
+    bool remove(const char *path);
+    bool remove(const String &path);
+    bool rename(const char *from, const char *to);
+    bool rename(const String &from, const String &to);
+
+private:
+    std::string hostPath(const char *path) const;
+
+    std::string root;
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif // HAL_NATIVE_H
@@ -0,0 +1,64 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include "hal.h"
+#include <ArduinoJson.h>
+#include <functional>
+#include <vector>
+
+// fills element with the next array element, false after the last one
+typedef std::function<bool(JsonDocument &element)> JsonElementSource;
+
+// JSON text produced piece by piece for a chunked response, so RAM use does
+// not depend on the size of the document. fill() is the body of the response
+// filler.
+class JsonStream
+{
+public:
+    virtual ~JsonStream() {}
+    // copies the next part of the document into buffer, 0 once it is complete
+    virtual size_t fill(uint8_t *buffer, size_t maxLen) = 0;
+};
+
+// JSON array serialized one element at a time
+class JsonArrayStream : public JsonStream
+{
+public:
+    explicit JsonArrayStream(JsonElementSource source);
+    size_t fill(uint8_t *buffer, size_t maxLen) override;
+
+private:
+    // serializes the next element into pending
+    void refill();
+
+    JsonElementSource source;
+    String pending;
+    size_t sent = 0;
+    size_t elements = 0;
+    bool finished = false;
+};
+
+// JSON object of streamed arrays, sent one member after the other
+class JsonObjectStream : public JsonStream
+{
+public:
+    // name is not escaped
+    void add(const char *name, JsonElementSource source);
+    size_t fill(uint8_t *buffer, size_t maxLen) override;
+
+private:
+    struct Member
+    {
+        const char *name;
+        JsonArrayStream array;
+    };
+
+    std::vector<Member> members;
+    size_t current = 0;
+    bool opened = false;
+    String pending;
+    size_t sent = 0;
+    bool finished = false;
+};
+
+#endif // JSON_STREAM_H
@@ -0,0 +1,44 @@
+#ifndef LCD_FRAMEBUFFER_H
+#define LCD_FRAMEBUFFER_H
+
+#include <Arduino.h>
+#include <LiquidCrystal_I2C.h>
+#include <atomic>
+
+#define LCD_COLS 20
+#define LCD_ROWS 4
+// how often the flush task looks for changes, in ms
+#define LCD_FLUSH_INTERVAL 20
+
+// 20x4 character framebuffer in front of the I2C display. clear(),
+// setCursor() and print() only touch RAM; a background task compares the
+// buffer against what the display shows and sends just the changed cells.
+// Text past the end of a row is clipped.
+class LcdFramebuffer : public Print
+{
+public:
+    explicit LcdFramebuffer(LiquidCrystal_I2C &device);
+    // initializes the display and starts the flush task
+    bool begin(int sda, int scl);
+    void backlight();
+    void clear();
+    void setCursor(uint8_t col, uint8_t row);
+    size_t write(uint8_t c) override;
+    using Print::write;
+
+private:
+    static void flushTask(void *arg);
+    // sends the cells that differ from the display, called by the flush task
+    void sendChanges();
+
+    LiquidCrystal_I2C &device;
+    char cells[LCD_ROWS][LCD_COLS];
+    // what the display currently shows, only used by the flush task
+    char shown[LCD_ROWS][LCD_COLS];
+    uint8_t col = 0;
+    uint8_t row = 0;
+    std::atomic<bool> dirty{false};
+    std::atomic<bool> backlightPending{false};
+};
+
+#endif // LCD_FRAMEBUFFER_H
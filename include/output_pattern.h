@@ -0,0 +1,43 @@
+#ifndef OUTPUT_PATTERN_H
+#define OUTPUT_PATTERN_H
+
+#include <Arduino.h>
+
+// One step of a pattern: the output is held on or off for duration ms
+struct PatternStep
+{
+    bool on;
+    uint16_t duration;
+};
+
+struct OutputPattern
+{
+    const PatternStep *steps;
+    uint8_t stepCount;
+};
+
+// Plays on/off patterns on a digital output without blocking. play() starts a
+// pattern, update() is called periodically and switches the output whenever
+// the current step has run out; the output returns to off after the last
+// step. Starting a new pattern replaces the running one.
+class OutputChannel
+{
+public:
+    // activeLow for outputs tied back to GND, like the reader LED and beeper
+    void begin(uint8_t pin, bool activeLow);
+    void play(const OutputPattern &pattern);
+    void stop();
+    bool busy() const;
+    void update();
+
+private:
+    void write(bool on);
+
+    uint8_t pin = 0;
+    bool activeLow = false;
+    const OutputPattern *pattern = nullptr;
+    uint8_t step = 0;
+    unsigned long stepStart = 0;
+};
+
+#endif // OUTPUT_PATTERN_H
@@ -0,0 +1,33 @@
+#ifndef SETTINGS_SNAPSHOT_H
+#define SETTINGS_SNAPSHOT_H
+
+#include "hal.h"
+
+// The settings as the boot snapshot holds them. Fixed size, so the whole file
+// is loaded with one read and nothing is parsed; settings.json is only read
+// when there is no snapshot of this version yet.
+struct SettingsSnapshot
+{
+    char mode[16];
+    uint32_t displayTimeout;
+    uint32_t frameGap;
+    uint8_t apMode;
+    uint8_t ssidHidden;
+    uint8_t spkOnInvalid;
+    uint8_t spkOnValid;
+    uint8_t ledValid;
+    uint8_t apChannel;
+    char apSsid[33];        // 32 chars, the longest SSID
+    char apPassphrase[64];  // 63 chars, the longest WPA2 passphrase
+    char customMessage[32]; // one LCD line of 20, with room for UTF-8
+    char welcomeMessage[16];
+};
+
+// false when the file is missing, of another version or damaged
+bool readSettingsSnapshot(fs::FS &fs, const char *path, SettingsSnapshot &settings);
+// replaces the file in one go through a temporary one
+bool writeSettingsSnapshot(fs::FS &fs, const char *path, const SettingsSnapshot &settings);
+// copies text into a field of the snapshot, cut to fit
+void setSnapshotText(char *field, size_t size, const char *text);
+
+#endif // SETTINGS_SNAPSHOT_H
@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include "hal.h"
+#include <atomic>
+
+// Bounded single-producer/single-consumer queue between two tasks, the same
+// scheme as EdgeRing: head is only written by push() and tail only by pop(),
+// so neither side ever blocks. Size must be a power of two.
+template <typename T, uint32_t Size>
+class SpscQueue
+{
+    static_assert((Size & (Size - 1)) == 0, "queue size must be a power of two");
+
+public:
+    // returns false and counts the item as dropped when the queue is full
+    bool push(const T &item)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Size)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[h & (Size - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    uint32_t droppedItems() const
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    T items[Size];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+};
+
+#endif // SPSC_QUEUE_H
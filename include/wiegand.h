@@ -0,0 +1,112 @@
+#ifndef WIEGAND_H
+#define WIEGAND_H
+
+#include "hal.h"
+#include <atomic>
+
+// number of edges the ring can hold, must be a power of two
+#define EDGE_RING_SIZE 256
+
+// max number of bits in a frame
+#define MAX_BITS 128
+#define FRAME_WORDS ((MAX_BITS + 31) / 32)
+
+// A single falling edge seen on DATA0 (bit 0) or DATA1 (bit 1)
+struct WiegandEdge
+{
+    uint8_t bit;
+    uint32_t timestamp; // micros() when the edge was seen
+};
+
+// Single-producer/single-consumer ring of reader edges.
+// The reader ISRs are the only producer and the capture task the only
+// consumer, so head is only written by push() and tail only by pop(); no locks
+// are needed.
+class EdgeRing
+{
+public:
+    // called from ISR context, returns false when the ring is full
+    bool push(uint8_t bit, uint32_t timestamp);
+    // called from the capture task, returns false when the ring is empty
+    bool pop(WiegandEdge &edge);
+    // like pop() but leaves the edge in the ring
+    bool peek(WiegandEdge &edge) const;
+    bool isEmpty() const;
+    // number of edges dropped because the consumer fell behind
+    uint32_t droppedEdges() const;
+
+private:
+    WiegandEdge edges[EDGE_RING_SIZE];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+};
+
+// A captured frame packed MSB first: the first bit received is the top bit of
+// words[0], so a field of the card is a shift and mask over one or two words.
+struct WiegandFrame
+{
+    uint32_t words[FRAME_WORDS];
+    // bits received, can be larger than MAX_BITS on an overrun
+    unsigned int bitCount;
+
+    void clear();
+    void append(uint8_t bit);
+    uint8_t bit(unsigned int index) const;
+    // up to 32 bits starting at index start
+    uint32_t bits(unsigned int start, unsigned int length) const;
+    // up to 64 bits starting at index start
+    uint64_t bits64(unsigned int start, unsigned int length) const;
+    // true when every received bit is 1, i.e. a data line is stuck low
+    bool allOnes() const;
+};
+
+// Assembles the edges of one reader into frames. A frame is complete once the
+// data lines have been quiet for the frame gap; an edge arriving after the gap
+// is left in the ring for the next frame.
+class FrameAssembler
+{
+public:
+    // moves the edges seen so far into the frame, returns true once it is
+    // complete; now and gap are in microseconds
+    bool poll(EdgeRing &ring, uint32_t now, uint32_t gap);
+    const WiegandFrame &frame() const;
+    // drops the frame and starts on the next one
+    void clear();
+
+private:
+    WiegandFrame current = {};
+    // timestamp of the last edge added to the frame
+    uint32_t lastEdgeTime = 0;
+    bool done = false;
+};
+
+// Capture state of one reader: the edges recorded by its interrupts and the
+// frame being assembled from them. Readers share nothing, so frames arriving
+// on several of them at once can't mix.
+class ReaderChannel
+{
+public:
+    // id is the reader number reads are tagged with, from 1
+    explicit ReaderChannel(uint8_t id);
+    virtual ~ReaderChannel() {}
+    // starts the capture, nothing to do for a channel fed by other means
+    virtual void begin() {}
+    // called from ISR context, returns false when the ring is full
+    bool pushEdge(uint8_t bit, uint32_t timestamp);
+    // called from the capture task, see FrameAssembler::poll()
+    bool poll(uint32_t now, uint32_t gap);
+    const WiegandFrame &frame() const;
+    void clear();
+    // no edges waiting to be assembled
+    bool isIdle() const;
+    uint32_t droppedEdges() const;
+    uint8_t id() const;
+
+private:
+    EdgeRing edges;
+    FrameAssembler assembler;
+    uint8_t readerId;
+};
+
+#endif // WIEGAND_H
@@ -0,0 +1,49 @@
+#ifndef WIEGAND_READER_H
+#define WIEGAND_READER_H
+
+#include <Arduino.h>
+#include "wiegand.h"
+
+// A reader wired to DATA0_PIN and DATA1_PIN. Every pin pair is a type of its
+// own with its own interrupt handlers, so a handler finds its channel without
+// an argument and stays as short as the single reader ones were. Only one
+// reader per pin pair.
+template <uint8_t DATA0_PIN, uint8_t DATA1_PIN>
+class WiegandReader : public ReaderChannel
+{
+public:
+    explicit WiegandReader(uint8_t id) : ReaderChannel(id)
+    {
+    }
+
+    // attaches the interrupts, the handlers only record the edge and the
+    // capture task assembles the frame
+    void begin() override
+    {
+        instance = this;
+        pinMode(DATA0_PIN, INPUT);
+        pinMode(DATA1_PIN, INPUT);
+        attachInterrupt(DATA0_PIN, isrData0, FALLING);
+        attachInterrupt(DATA1_PIN, isrData1, FALLING);
+    }
+
+private:
+    // DATA0 went low, a 0 bit
+    static void IRAM_ATTR isrData0()
+    {
+        instance->pushEdge(0, micros());
+    }
+
+    // DATA1 went low, a 1 bit
+    static void IRAM_ATTR isrData1()
+    {
+        instance->pushEdge(1, micros());
+    }
+
+    static WiegandReader *instance;
+};
+
+template <uint8_t DATA0_PIN, uint8_t DATA1_PIN>
+WiegandReader<DATA0_PIN, DATA1_PIN> *WiegandReader<DATA0_PIN, DATA1_PIN>::instance = nullptr;
+
+#endif // WIEGAND_READER_H
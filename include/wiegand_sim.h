@@ -0,0 +1,128 @@
+#ifndef WIEGAND_SIM_H
+#define WIEGAND_SIM_H
+
+#include "hal.h"
+#include "wiegand.h"
+#include "card_formats.h"
+#include <memory>
+#include <random>
+#include <vector>
+
+// Timing of a simulated reader, in microseconds
+struct PulseTrainConfig
+{
+    uint32_t pulseWidth = 50;    // low time of a data pulse
+    uint32_t bitInterval = 2000; // start of one pulse to the start of the next
+    uint32_t jitter = 0;         // largest random shift of a pulse, either way
+    uint32_t frameGap = 20000;   // silence after the last pulse of a frame
+    float glitchRate = 0;        // chance of a spurious pulse after each bit
+    uint32_t glitchWidth = 5;
+    uint64_t startTime = 0;      // time of the first pulse, micros() wraps at 2^32
+};
+
+// A falling edge on DATA0 (line 0) or DATA1 (line 1)
+struct SimulatedEdge
+{
+    uint64_t time;
+    uint8_t line;
+    uint8_t reader; // index of the train when several are replayed
+};
+
+// Pulse trains of frames as a reader puts them on DATA0 and DATA1. A line
+// held low by one pulse swallows the falling edge of a pulse starting before
+// it is released, so overlapping pulses and glitches lose edges like on the
+// wires.
+class PulseTrain
+{
+public:
+    PulseTrain(const PulseTrainConfig &config, uint32_t seed);
+    // appends the pulses of a frame after the gap that ends the previous one
+    void addFrame(const WiegandFrame &frame);
+    // falling edges of every frame added, in time order
+    std::vector<SimulatedEdge> edges() const;
+    const std::vector<WiegandFrame> &frames() const;
+    // end of the gap after the last frame
+    uint64_t endTime() const;
+    size_t glitches() const;
+
+private:
+    struct Pulse
+    {
+        uint64_t start;
+        uint32_t width;
+        uint8_t line;
+    };
+
+    int32_t jitter();
+
+    PulseTrainConfig config;
+    std::mt19937 generator;
+    std::vector<Pulse> pulses;
+    std::vector<WiegandFrame> sent;
+    uint64_t time;
+    size_t glitchCount = 0;
+};
+
+// How the capture task runs, in microseconds
+struct CaptureConfig
+{
+    uint32_t frameGap = 5000;     // silence that ends a frame, the frameGap setting
+    uint32_t pollInterval = 1000; // one vTaskDelay(1) tick
+    uint32_t stallInterval = 0;   // every so often the task is held up...
+    uint32_t stallTime = 0;       // ...for this long, 0 never
+};
+
+struct SimulationResult
+{
+    size_t framesSent;
+    size_t framesCaptured;   // frames the capture handed on, all ones excluded
+    size_t framesCorrect;    // captured exactly as sent
+    size_t framesMangled;    // captured but not as any frame sent
+    size_t framesUndetected; // mangled, yet decoded as a valid card
+    size_t edgesDropped;     // lost to a full edge ring
+    uint64_t simulatedTime;
+    double hostSeconds;
+
+    // correct frames per simulated second
+    double framesPerSecond() const;
+    // share of the captured frames that were correct
+    double accuracy() const;
+    // share of the frames sent that did not come out correct
+    double dropRate() const;
+};
+
+// Replays pulse trains through the capture path of the firmware: the
+// interrupt entry points push into the ReaderChannel of their reader, a
+// simulated capture task polls every channel each pollInterval and decodes
+// what they complete.
+class WiegandSimulator
+{
+public:
+    explicit WiegandSimulator(const CaptureConfig &config);
+    SimulationResult run(const PulseTrain &train);
+    // one train per reader, replayed at the same time
+    std::vector<SimulationResult> run(const std::vector<const PulseTrain *> &trains);
+
+    // what the DATA0 and DATA1 interrupt handlers of a reader do, with the
+    // simulated clock as micros()
+    void isrData0(size_t reader);
+    void isrData1(size_t reader);
+
+private:
+    struct Reader
+    {
+        std::unique_ptr<ReaderChannel> channel;
+        const std::vector<WiegandFrame> *sent;
+        // first frame sent not matched yet
+        size_t next;
+    };
+
+    // compares a completed frame with the frames the reader sent
+    void score(Reader &reader, const WiegandFrame &frame, SimulationResult &result);
+
+    CaptureConfig config;
+    std::vector<Reader> readers;
+    uint64_t now = 0;
+};
+
+#endif // WIEGAND_SIM_H
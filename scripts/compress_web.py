@@ -0,0 +1,58 @@
+# Pre-build step of env:esp32dev: writes gzip-compressed copies of the web
+# interface into data/ before the filesystem image is built.
+#
+#   data/assets/<name>.<hash>.<ext>.gz   script.js and style.css, named after
+#                                         their content, cached for good
+#   data/index.html.gz                    index.html pointing at them
+#
+# The web server sends the .gz files with Content-Encoding: gzip. A changed
+# script or stylesheet gets a new name, so browsers never see a stale one.
+
+import gzip
+import hashlib
+import os
+
+Import("env")
+
+ASSETS = ["script.js", "style.css"]
+HASH_LENGTH = 8
+
+
+def write_gzip(path, content):
+    # mtime 0 keeps the output the same for the same input
+    with open(path, "wb") as out:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=out, compresslevel=9, mtime=0) as compressed:
+            compressed.write(content)
+
+
+def fingerprint(name, content):
+    stem, ext = os.path.splitext(name)
+    return "%s.%s%s" % (stem, hashlib.sha256(content).hexdigest()[:HASH_LENGTH], ext)
+
+
+def compress_web(data_dir):
+    assets_dir = os.path.join(data_dir, "assets")
+    os.makedirs(assets_dir, exist_ok=True)
+
+    names = {}
+    for name in ASSETS:
+        with open(os.path.join(data_dir, name), "rb") as source:
+            content = source.read()
+        names[name] = fingerprint(name, content)
+        write_gzip(os.path.join(assets_dir, names[name] + ".gz"), content)
+
+    # the ones of earlier builds would only take up space in the image
+    for stale in os.listdir(assets_dir):
+        if stale[: -len(".gz")] not in names.values():
+            os.remove(os.path.join(assets_dir, stale))
+
+    with open(os.path.join(data_dir, "index.html"), "r", encoding="utf-8") as source:
+        index = source.read()
+    for name, hashed in names.items():
+        index = index.replace('"%s"' % name, '"assets/%s"' % hashed)
+    write_gzip(os.path.join(data_dir, "index.html.gz"), index.encode("utf-8"))
+
+    print("Compressed web interface: %s" % ", ".join(["index.html"] + sorted(names.values())))
+
+
+compress_web(env.subst("$PROJECT_DATA_DIR"))
@@ -0,0 +1,375 @@
+#include "audit_log.h"
+
+// segment file header, followed by the records
+struct AuditSegmentHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t number;
+  uint32_t firstSequence;
+};
+
+static const uint32_t AUDIT_LOG_MAGIC = 0x4C415344; // "DSAL"
+// 2: CardRecord::reader took padding that version 1 left undefined
+static const uint16_t AUDIT_LOG_VERSION = 2;
+static const uint32_t AUDIT_SEGMENT_RECORDS = (AUDIT_SEGMENT_SIZE - sizeof(AuditSegmentHeader)) / sizeof(CardRecord);
+
+static_assert(AUDIT_SEGMENT_RECORDS > 0, "audit segments are too small for a record");
+
+String AuditLog::slotPath(uint32_t slot) const
+{
+  return String(path) + "." + String(slot);
+}
+
+AuditLog::Segment *AuditLog::segment(uint32_t number)
+{
+  Segment &candidate = segments[number % AUDIT_SEGMENTS];
+  return candidate.valid && candidate.number == number ? &candidate : nullptr;
+}
+
+bool AuditLog::readRecord(File &in, uint32_t index, CardRecord &record)
+{
+  return in.seek(sizeof(AuditSegmentHeader) + index * sizeof(CardRecord)) &&
+         in.read((uint8_t *)&record, sizeof(record)) == sizeof(record);
+}
+
+bool AuditLog::loadSegment(uint32_t slot, int64_t &lastTime)
+{
+  Segment &loaded = segments[slot];
+  loaded.valid = false;
+  File in = fs->open(slotPath(slot), "r");
+  if (!in)
+  {
+    return false;
+  }
+
+  AuditSegmentHeader header;
+  if (in.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.magic != AUDIT_LOG_MAGIC ||
+      header.version != AUDIT_LOG_VERSION || header.recordSize != sizeof(CardRecord) || header.number % AUDIT_SEGMENTS != slot)
+  {
+    return false;
+  }
+
+  // a record cut short by a reset is not counted
+  loaded.number = header.number;
+  loaded.firstSequence = header.firstSequence;
+  loaded.count = (in.size() - sizeof(header)) / sizeof(CardRecord);
+  loaded.firstTime = 0;
+  lastTime = 0;
+  CardRecord record;
+  if (loaded.count > 0)
+  {
+    if (!readRecord(in, 0, record))
+    {
+      return false;
+    }
+    loaded.firstTime = record.timestamp;
+    if (!readRecord(in, loaded.count - 1, record))
+    {
+      return false;
+    }
+    lastTime = record.timestamp;
+  }
+  loaded.valid = true;
+  return (in.size() - sizeof(header)) % sizeof(CardRecord) == 0;
+}
+
+bool AuditLog::begin(fs::FS &fs, const char *path)
+{
+  this->fs = &fs;
+  this->path = path;
+  bufferCount = 0;
+  if (file)
+  {
+    file.close();
+  }
+
+  bool found = false;
+  bool complete = false;
+  int64_t lastTime = 0;
+  for (uint32_t slot = 0; slot < AUDIT_SEGMENTS; slot++)
+  {
+    int64_t segmentLast;
+    bool aligned = loadSegment(slot, segmentLast);
+    if (!segments[slot].valid || (found && segments[slot].number < newest))
+    {
+      continue;
+    }
+    found = true;
+    newest = segments[slot].number;
+    complete = aligned;
+    lastTime = segmentLast;
+  }
+
+  // segments from an older run of the ring don't belong to the log
+  for (uint32_t slot = 0; slot < AUDIT_SEGMENTS; slot++)
+  {
+    if (segments[slot].valid && newest - segments[slot].number >= AUDIT_SEGMENTS)
+    {
+      segments[slot].valid = false;
+    }
+  }
+
+  if (!found)
+  {
+    next = 1;
+    clockOffset = 0;
+    return startSegment(0);
+  }
+
+  const Segment &last = segments[newest % AUDIT_SEGMENTS];
+  next = last.firstSequence + last.count;
+  if (last.count == 0 && segment(newest - 1) != nullptr)
+  {
+    // the newest segment was started right before the reset
+    const Segment &previous = *segment(newest - 1);
+    File in = fs.open(slotPath((newest - 1) % AUDIT_SEGMENTS), "r");
+    CardRecord record;
+    if (previous.count > 0 && in && readRecord(in, previous.count - 1, record))
+    {
+      lastTime = record.timestamp;
+    }
+  }
+  // the capture clock restarts at 0 on every boot
+  clockOffset = lastTime > 0 ? lastTime + 1 : 0;
+
+  if (!complete)
+  {
+    // appending would misalign every following record
+    return startSegment(newest + 1);
+  }
+  file = fs.open(slotPath(newest % AUDIT_SEGMENTS), "a");
+  return (bool)file;
+}
+
+bool AuditLog::startSegment(uint32_t number)
+{
+  if (file)
+  {
+    file.close();
+  }
+  uint32_t slot = number % AUDIT_SEGMENTS;
+  String target = slotPath(slot);
+  Segment &started = segments[slot];
+  started.valid = false;
+  if (fs->exists(target))
+  {
+    fs->remove(target);
+  }
+
+  file = fs->open(target, "a");
+  AuditSegmentHeader header = {AUDIT_LOG_MAGIC, AUDIT_LOG_VERSION, sizeof(CardRecord), number, next};
+  if (!file || file.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+  {
+    file.close();
+    fs->remove(target);
+    return false;
+  }
+  file.flush();
+  started = {number, next, 0, 0, true};
+  newest = number;
+  return true;
+}
+
+uint32_t AuditLog::append(const CardRecord &record)
+{
+  if (fs == nullptr)
+  {
+    return 0;
+  }
+  Segment *current = segment(newest);
+  if (!file || current == nullptr || current->count >= AUDIT_SEGMENT_RECORDS)
+  {
+    // full, or the last write failed and left the file unusable
+    flush();
+    if (!startSegment(newest + 1))
+    {
+      return 0;
+    }
+    current = segment(newest);
+  }
+
+  CardRecord &logged = buffer[bufferCount];
+  logged = record;
+  logged.sequence = next;
+  logged.timestamp += clockOffset;
+  if (bufferCount++ == 0)
+  {
+    bufferTime = millis();
+  }
+
+  if (current->count == 0)
+  {
+    current->firstTime = logged.timestamp;
+  }
+  current->count++;
+  uint32_t sequence = next++;
+  if (bufferCount == AUDIT_BUFFER_RECORDS)
+  {
+    flush();
+  }
+  return sequence;
+}
+
+bool AuditLog::flush()
+{
+  if (bufferCount == 0)
+  {
+    return true;
+  }
+  size_t size = bufferCount * sizeof(CardRecord);
+  bool written = file && file.write((const uint8_t *)buffer, size) == size;
+  if (written)
+  {
+    file.flush();
+  }
+  else
+  {
+    // the records are gone, the next append starts a new segment after them
+    Segment *current = segment(newest);
+    if (current != nullptr)
+    {
+      current->count -= bufferCount;
+    }
+    file.close();
+  }
+  bufferCount = 0;
+  return written;
+}
+
+bool AuditLog::buffered() const
+{
+  return bufferCount > 0;
+}
+
+bool AuditLog::flushDue() const
+{
+  return bufferCount > 0 && millis() - bufferTime >= AUDIT_FLUSH_INTERVAL;
+}
+
+size_t AuditLog::read(uint32_t sequence, CardRecord *records, size_t count)
+{
+  flush();
+  uint32_t oldest = firstSequence();
+  if (sequence < oldest)
+  {
+    sequence = oldest;
+  }
+
+  size_t n = 0;
+  while (n < count && sequence < next)
+  {
+    // the segment holding the sequence, or the next one after a segment that
+    // could not be loaded
+    const Segment *found = nullptr;
+    for (uint32_t slot = 0; slot < AUDIT_SEGMENTS; slot++)
+    {
+      const Segment &candidate = segments[slot];
+      if (!candidate.valid || candidate.count == 0 || candidate.firstSequence + candidate.count <= sequence)
+      {
+        continue;
+      }
+      if (found == nullptr || candidate.firstSequence < found->firstSequence)
+      {
+        found = &candidate;
+      }
+    }
+    if (found == nullptr)
+    {
+      break;
+    }
+    if (sequence < found->firstSequence)
+    {
+      sequence = found->firstSequence;
+    }
+
+    File in = fs->open(slotPath(found->number % AUDIT_SEGMENTS), "r");
+    uint32_t index = sequence - found->firstSequence;
+    if (!in || !in.seek(sizeof(AuditSegmentHeader) + index * sizeof(CardRecord)))
+    {
+      break;
+    }
+    size_t wanted = min((size_t)(found->count - index), count - n);
+    size_t got = in.read((uint8_t *)(records + n), wanted * sizeof(CardRecord)) / sizeof(CardRecord);
+    n += got;
+    sequence += got;
+    if (got < wanted)
+    {
+      break;
+    }
+  }
+  return n;
+}
+
+uint32_t AuditLog::findTime(int64_t time)
+{
+  flush();
+  // last segment starting at or before the time, the oldest one otherwise
+  const Segment *found = nullptr;
+  for (uint32_t number = newest + 1 - AUDIT_SEGMENTS; number != newest + 1; number++)
+  {
+    const Segment *candidate = segment(number);
+    if (candidate == nullptr || candidate->count == 0)
+    {
+      continue;
+    }
+    if (found == nullptr || candidate->firstTime <= time)
+    {
+      found = candidate;
+    }
+  }
+  if (found == nullptr)
+  {
+    return next;
+  }
+  if (found->firstTime >= time)
+  {
+    return found->firstSequence;
+  }
+
+  // first record of the segment at or after the time
+  File in = fs->open(slotPath(found->number % AUDIT_SEGMENTS), "r");
+  if (!in)
+  {
+    return next;
+  }
+  uint32_t low = 0;
+  uint32_t high = found->count;
+  CardRecord record;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (!readRecord(in, mid, record))
+    {
+      return next;
+    }
+    if (record.timestamp < time)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return found->firstSequence + low;
+}
+
+uint32_t AuditLog::firstSequence() const
+{
+  uint32_t oldest = next;
+  for (uint32_t slot = 0; slot < AUDIT_SEGMENTS; slot++)
+  {
+    if (segments[slot].valid && segments[slot].count > 0 && segments[slot].firstSequence < oldest)
+    {
+      oldest = segments[slot].firstSequence;
+    }
+  }
+  return oldest;
+}
+
+uint32_t AuditLog::nextSequence() const
+{
+  return next;
+}
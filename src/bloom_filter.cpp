@@ -0,0 +1,97 @@
+#include "bloom_filter.h"
+
+#include <new>
+
+BloomFilter::~BloomFilter()
+{
+  delete[] bits;
+}
+
+bool BloomFilter::begin(size_t keys)
+{
+  size_t words = (keys * BLOOM_BITS_PER_KEY + 31) / 32;
+  if (words < 2)
+  {
+    words = 2;
+  }
+
+  delete[] bits;
+  bits = new (std::nothrow) uint32_t[words];
+  if (bits == nullptr)
+  {
+    bitCount = 0;
+    return false;
+  }
+  bitCount = words * 32;
+  clear();
+  return true;
+}
+
+void BloomFilter::clear()
+{
+  for (uint32_t i = 0; i < bitCount / 32; i++)
+  {
+    bits[i] = 0;
+  }
+}
+
+void BloomFilter::add(uint64_t keyHash)
+{
+  if (bits == nullptr)
+  {
+    return;
+  }
+  // double hashing, the probes are h1 + i * h2
+  uint32_t h1 = (uint32_t)keyHash;
+  uint32_t h2 = (uint32_t)(keyHash >> 32) | 1;
+  for (unsigned int i = 0; i < BLOOM_PROBES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) % bitCount;
+    bits[bit >> 5] |= (uint32_t)1 << (bit & 31);
+  }
+}
+
+bool BloomFilter::mayContain(uint64_t keyHash) const
+{
+  if (bits == nullptr)
+  {
+    // without a filter every key has to be looked up
+    return true;
+  }
+  uint32_t h1 = (uint32_t)keyHash;
+  uint32_t h2 = (uint32_t)(keyHash >> 32) | 1;
+  for (unsigned int i = 0; i < BLOOM_PROBES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) % bitCount;
+    if ((bits[bit >> 5] & ((uint32_t)1 << (bit & 31))) == 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t BloomFilter::sizeBytes() const
+{
+  return bitCount / 8;
+}
+
+uint8_t *BloomFilter::data()
+{
+  return (uint8_t *)bits;
+}
+
+const uint8_t *BloomFilter::data() const
+{
+  return (const uint8_t *)bits;
+}
+
+void BloomFilter::swap(BloomFilter &other)
+{
+  uint32_t *otherBits = other.bits;
+  uint32_t otherBitCount = other.bitCount;
+  other.bits = bits;
+  other.bitCount = bitCount;
+  bits = otherBits;
+  bitCount = otherBitCount;
+}
@@ -0,0 +1,87 @@
+#include "card_decoder.h"
+
+void decideCard(CardEvent &event, CredentialStore &store)
+{
+  event.format = detectCardFormat(event.frame, event.parityValid);
+  if (event.format == nullptr)
+  {
+    event.result = ACCESS_UNKNOWN_FORMAT;
+  }
+  else
+  {
+    event.facilityCode = decodeFacilityCode(event.frame, *event.format);
+    event.cardNumber = decodeCardNumber(event.frame, *event.format);
+    if (!event.parityValid)
+    {
+      event.result = ACCESS_PARITY_ERROR;
+    }
+    else
+    {
+      // lock free, a change being saved by the web server can't hold it up
+      bool found = store.lookup(event.facilityCode, event.cardNumber, event.credential);
+      event.result = found ? ACCESS_GRANTED : ACCESS_DENIED;
+    }
+  }
+  event.decisionTime = esp_timer_get_time();
+}
+
+void formatCardRecord(const CardRecord &record, char *hex, char *raw)
+{
+  WiegandFrame recordFrame;
+  record.getFrame(recordFrame);
+  const CardFormat *format = cardFormatById(record.formatId);
+  if (format != nullptr)
+  {
+    formatCardHex(recordFrame, *format, hex);
+  }
+  else
+  {
+    hex[0] = '\0';
+  }
+  for (unsigned int i = 0; i < recordFrame.bitCount; i++)
+  {
+    raw[i] = '0' + recordFrame.bit(i);
+  }
+  raw[recordFrame.bitCount] = '\0';
+}
+
+void cardRecordToJson(const CardRecord &record, JsonObject card)
+{
+  char hex[CARD_HEX_SIZE];
+  char raw[MAX_BITS + 1];
+  formatCardRecord(record, hex, raw);
+  const CardFormat *format = cardFormatById(record.formatId);
+
+  card["sequence"] = record.sequence;
+  card["timestamp"] = record.timestamp;
+  card["reader"] = record.reader;
+  card["bitCount"] = record.bitCount;
+  card["format"] = format != nullptr ? format->name : "";
+  card["facilityCode"] = record.facilityCode;
+  card["cardNumber"] = record.cardNumber;
+  card["hexCardData"] = hex;
+  card["rawCardData"] = raw;
+  card["status"] = cardStatusName(record.status);
+  switch (record.status)
+  {
+  case CARD_READ:
+    card["details"] = String("Hex: ") + hex;
+    break;
+  case CARD_AUTHORIZED:
+    card["details"] = record.name;
+    break;
+  case CARD_UNAUTHORIZED:
+    card["details"] = "FC: " + String(record.facilityCode) + ", CN: " + String(record.cardNumber);
+    break;
+  case CARD_PARITY_ERROR:
+    card["details"] = "Format: " + String(format != nullptr ? format->name : "") + ", Hex: " + hex;
+    break;
+  }
+}
+
+void credentialToJson(const Credential &credential, JsonObject user)
+{
+  user["facilityCode"] = credential.facilityCode;
+  user["cardNumber"] = credential.cardNumber;
+  user["name"] = credential.name;
+}
@@ -0,0 +1,282 @@
+#include "card_formats.h"
+
+// Parity check over the contiguous bits [start, start + length) plus the
+// parity bit itself
+static constexpr ParityCheck parityRange(bool odd, uint8_t bit, uint8_t start, uint8_t length)
+{
+  ParityCheck check{};
+  check.bit = bit;
+  check.odd = odd;
+  check.mask[bit >> 5] |= (uint32_t)1 << (31 - (bit & 31));
+  for (unsigned int i = start; i < (unsigned int)(start + length); i++)
+  {
+    check.mask[i >> 5] |= (uint32_t)1 << (31 - (i & 31));
+  }
+  return check;
+}
+
+// Parity check over two of every three bits of [start, end], as used by the
+// Corporate 1000 formats
+static constexpr ParityCheck parityTwoOfThree(bool odd, uint8_t bit, uint8_t start, uint8_t end)
+{
+  ParityCheck check{};
+  check.bit = bit;
+  check.odd = odd;
+  check.mask[bit >> 5] |= (uint32_t)1 << (31 - (bit & 31));
+  for (unsigned int i = start; i <= end; i++)
+  {
+    if ((i - start) % 3 != 2)
+    {
+      check.mask[i >> 5] |= (uint32_t)1 << (31 - (i & 31));
+    }
+  }
+  return check;
+}
+
+// Card formats. The position of a format is its id in stored records, so new
+// formats go at the end; formats sharing a length are told apart by their
+// parity, see detectCardFormat(). See
+// http://www.pagemac.com/projects/rfid/hid_data_formats and
+// www.brivo.com/app/static_data/js/calculate.js for the layouts.
+static constexpr CardFormat cardFormats[] = {
+    {"H10301", 26, {1, 8}, {9, 16}, 2, {parityRange(false, 0, 1, 12), parityRange(true, 25, 13, 12)}, HEX_HID},
+    {"HID 27", 27, {1, 12}, {13, 14}, 0, {}, HEX_HID},
+    {"HID 29", 29, {1, 12}, {13, 16}, 0, {}, HEX_HID},
+    {"HID 30", 30, {1, 12}, {13, 16}, 0, {}, HEX_HID},
+    {"HID 31", 31, {1, 4}, {5, 23}, 0, {}, HEX_HID},
+    // modified to wiegand 32 bit format instead of HID
+    {"Wiegand 32", 32, {5, 11}, {17, 15}, 0, {}, HEX_HID},
+    {"HID 33", 33, {1, 7}, {8, 24}, 0, {}, HEX_HID},
+    {"H10306", 34, {1, 16}, {17, 16}, 2, {parityRange(false, 0, 1, 16), parityRange(true, 33, 17, 16)}, HEX_HID},
+    {"Corporate 1000 35", 35, {2, 12}, {14, 20}, 3, {parityTwoOfThree(false, 1, 2, 33), parityTwoOfThree(true, 34, 1, 32), parityRange(true, 0, 1, 34)}, HEX_HID},
+    {"HID 36", 36, {21, 12}, {1, 16}, 0, {}, HEX_HID},
+    {"H10304", 37, {1, 16}, {17, 19}, 2, {parityRange(false, 0, 1, 18), parityRange(true, 36, 18, 18)}, HEX_HID},
+    {"Corporate 1000 48", 48, {2, 22}, {24, 23}, 3, {parityTwoOfThree(false, 1, 2, 45), parityTwoOfThree(true, 47, 1, 46), parityRange(true, 0, 1, 47)}, HEX_RAW},
+    // long credentials without a public layout: the low 64 bits are the card
+    // number and whatever is above them the facility code
+    {"Raw 64", 64, {0, 0}, {0, 64}, 0, {}, HEX_RAW},
+    {"Raw 96", 96, {0, 32}, {32, 64}, 0, {}, HEX_RAW},
+    {"Raw 128", 128, {0, 64}, {64, 64}, 0, {}, HEX_RAW},
+    // Keyscan 36 bit, shares its length with HID 36, which has no parity; the
+    // 10 bit OEM code at bit 1 is not decoded
+    {"C15001", 36, {11, 8}, {19, 16}, 2, {parityRange(false, 0, 1, 17), parityRange(true, 35, 18, 17)}, HEX_HID},
+};
+
+static constexpr unsigned int FORMAT_COUNT = sizeof(cardFormats) / sizeof(cardFormats[0]);
+static constexpr uint8_t NO_FORMAT = NO_CARD_FORMAT;
+
+static_assert(FORMAT_COUNT < NO_FORMAT, "too many card formats for the length index");
+
+// true when every parity bit of the format lies inside the frame
+static constexpr bool parityBitInFrame(const CardFormat &format)
+{
+  for (unsigned int i = 0; i < format.parityCount; i++)
+  {
+    if (format.parity[i].bit >= format.bitCount)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static constexpr bool cardFormatsValid()
+{
+  for (unsigned int i = 0; i < FORMAT_COUNT; i++)
+  {
+    const CardFormat &format = cardFormats[i];
+    if (format.bitCount == 0 || format.bitCount > MAX_BITS)
+    {
+      return false;
+    }
+    if (format.facilityCode.length > 64 || format.facilityCode.start + format.facilityCode.length > format.bitCount)
+    {
+      return false;
+    }
+    if (format.cardNumber.length > 64 || format.cardNumber.start + format.cardNumber.length > format.bitCount)
+    {
+      return false;
+    }
+    if (format.parityCount > MAX_PARITY_CHECKS || !parityBitInFrame(format))
+    {
+      return false;
+    }
+    // the HID preamble bit 37 has to sit above the card data
+    if (format.hexLayout == HEX_HID && format.bitCount > 37)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(cardFormatsValid(), "card format table has a field out of range");
+
+// first format of each bit length, and after each format the next one of
+// its length
+struct FormatIndex
+{
+  uint8_t first[MAX_BITS + 1];
+  uint8_t next[FORMAT_COUNT];
+};
+
+static constexpr FormatIndex buildFormatIndex()
+{
+  FormatIndex index{};
+  for (unsigned int i = 0; i <= MAX_BITS; i++)
+  {
+    index.first[i] = NO_FORMAT;
+  }
+  for (unsigned int i = FORMAT_COUNT; i-- > 0;)
+  {
+    index.next[i] = index.first[cardFormats[i].bitCount];
+    index.first[cardFormats[i].bitCount] = i;
+  }
+  return index;
+}
+
+static constexpr FormatIndex formatIndex = buildFormatIndex();
+
+const CardFormat *findCardFormat(unsigned int bitCount)
+{
+  if (bitCount > MAX_BITS || formatIndex.first[bitCount] == NO_FORMAT)
+  {
+    return nullptr;
+  }
+  return &cardFormats[formatIndex.first[bitCount]];
+}
+
+uint8_t cardFormatId(const CardFormat *format)
+{
+  return format != nullptr ? format - cardFormats : NO_FORMAT;
+}
+
+const CardFormat *cardFormatById(uint8_t id)
+{
+  return id < FORMAT_COUNT ? &cardFormats[id] : nullptr;
+}
+
+// number of parity checks of the format the frame passes
+static unsigned int parityScore(const WiegandFrame &frame, const CardFormat &format)
+{
+  unsigned int passed = 0;
+  for (unsigned int i = 0; i < format.parityCount; i++)
+  {
+    const ParityCheck &check = format.parity[i];
+    unsigned int ones = 0;
+    for (unsigned int w = 0; w < FRAME_WORDS; w++)
+    {
+      ones += __builtin_popcount(frame.words[w] & check.mask[w]);
+    }
+    if ((ones & 1) == (check.odd ? 1u : 0u))
+    {
+      passed++;
+    }
+  }
+  return passed;
+}
+
+bool checkParity(const WiegandFrame &frame, const CardFormat &format)
+{
+  return parityScore(frame, format) == format.parityCount;
+}
+
+const CardFormat *detectCardFormat(const WiegandFrame &frame, bool &parityValid)
+{
+  parityValid = false;
+  if (frame.bitCount > MAX_BITS || formatIndex.first[frame.bitCount] == NO_FORMAT)
+  {
+    return nullptr;
+  }
+
+  // a format whose parity passes wins, then the one passing the most checks;
+  // ties go to the earlier table entry
+  const CardFormat *best = nullptr;
+  unsigned int bestScore = 0;
+  for (unsigned int i = formatIndex.first[frame.bitCount]; i != NO_FORMAT; i = formatIndex.next[i])
+  {
+    const CardFormat &format = cardFormats[i];
+    unsigned int score = parityScore(frame, format);
+    bool valid = score == format.parityCount;
+    if (best == nullptr || (valid && !parityValid) || (valid == parityValid && score > bestScore))
+    {
+      best = &format;
+      bestScore = score;
+      parityValid = valid;
+    }
+  }
+  return best;
+}
+
+uint64_t decodeFacilityCode(const WiegandFrame &frame, const CardFormat &format)
+{
+  return frame.bits64(format.facilityCode.start, format.facilityCode.length);
+}
+
+uint64_t decodeCardNumber(const WiegandFrame &frame, const CardFormat &format)
+{
+  return frame.bits64(format.cardNumber.start, format.cardNumber.length);
+}
+
+void formatCardHex(const WiegandFrame &frame, const CardFormat &format, char *out)
+{
+  static const char digits[] = "0123456789abcdef";
+
+  if (format.hexLayout == HEX_HID)
+  {
+    // Example of full card value
+    // |>   preamble   <| |>   Actual card value   <|
+    // 000000100000000001 11 111000100000100100111000
+    // |> write to chunk1 <| |>  write to chunk2   <|
+    uint64_t cardValue = (1ULL << 37) | (1ULL << format.bitCount) | frame.bits64(0, format.bitCount);
+    unsigned long cardChunk1 = cardValue >> 24;
+    unsigned long cardChunk2 = cardValue & 0xFFFFFF;
+    snprintf(out, CARD_HEX_SIZE, "%lx%06lx", cardChunk1, cardChunk2);
+    return;
+  }
+
+  // the first nibble takes the bits left over by the whole nibbles
+  unsigned int length = format.bitCount % 4 == 0 ? 4 : format.bitCount % 4;
+  unsigned int n = 0;
+  for (unsigned int start = 0; start < format.bitCount; start += length, length = 4)
+  {
+    out[n++] = digits[frame.bits(start, length)];
+  }
+  out[n] = '\0';
+}
+
+// writes value into the field, its top bit first
+static void encodeField(WiegandFrame &frame, const BitField &field, uint64_t value)
+{
+  for (unsigned int i = 0; i < field.length; i++)
+  {
+    unsigned int index = field.start + i;
+    if ((value >> (field.length - 1 - i)) & 1)
+    {
+      frame.words[index >> 5] |= (uint32_t)1 << (31 - (index & 31));
+    }
+  }
+}
+
+void encodeCardFrame(const CardFormat &format, uint64_t facilityCode, uint64_t cardNumber, WiegandFrame &frame)
+{
+  frame.clear();
+  frame.bitCount = format.bitCount;
+  encodeField(frame, format.facilityCode, facilityCode);
+  encodeField(frame, format.cardNumber, cardNumber);
+
+  // in table order, a check may cover the parity bits of the earlier ones
+  for (unsigned int i = 0; i < format.parityCount; i++)
+  {
+    const ParityCheck &check = format.parity[i];
+    unsigned int ones = 0;
+    for (unsigned int w = 0; w < FRAME_WORDS; w++)
+    {
+      ones += __builtin_popcount(frame.words[w] & check.mask[w]);
+    }
+    if ((ones & 1) != (check.odd ? 1u : 0u))
+    {
+      frame.words[check.bit >> 5] ^= (uint32_t)1 << (31 - (check.bit & 31));
+    }
+  }
+}
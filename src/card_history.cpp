@@ -0,0 +1,542 @@
+#include "card_history.h"
+
+#include <string.h>
+
+// record tag: the status in the low bits, the literal flag, and the
+// dictionary index of a repeated card in the high bits
+static const uint8_t TAG_STATUS_MASK = 0x03;
+static const uint8_t TAG_LITERAL = 0x04;
+static const uint8_t TAG_INDEX_SHIFT = 3;
+// indexes from this one on continue in a varint
+static const uint8_t TAG_INDEX_ESCAPE = 31;
+
+static const size_t VARINT_MAX_SIZE = 10;
+// literal head: the kind in the low bits, the name length in the high bits
+static const uint8_t LITERAL_KIND_MASK = 0x03;
+static const uint8_t LITERAL_FRAME = 0;
+static const uint8_t LITERAL_FACILITY = 1;
+static const uint8_t LITERAL_MEMBER = 2;
+static const uint8_t LITERAL_NAME_SHIFT = 4;
+// head and name, then bit count, format id, reader and the frame bits, or
+// format id, reader and two varints
+static const size_t FRAME_LITERAL_MAX_SIZE = 4 + sizeof(CardRecord::name) + MAX_BITS / 8;
+static const size_t FACILITY_LITERAL_MAX_SIZE = 3 + sizeof(CardRecord::name) + 2 * VARINT_MAX_SIZE;
+static const size_t LITERAL_MAX_SIZE =
+    FRAME_LITERAL_MAX_SIZE > FACILITY_LITERAL_MAX_SIZE ? FRAME_LITERAL_MAX_SIZE : FACILITY_LITERAL_MAX_SIZE;
+static const size_t RECORD_MAX_SIZE = 1 + VARINT_MAX_SIZE + LITERAL_MAX_SIZE;
+
+static_assert(RECORD_MAX_SIZE <= CARD_HISTORY_BLOCK_SIZE, "history blocks are too small for a record");
+static_assert(CARD_HISTORY_DICTIONARY <= 255, "dictionary index does not fit the encoder state");
+static_assert(CARD_HISTORY_FACILITIES <= 255, "facility index does not fit the encoder state");
+static_assert(sizeof(CardRecord::name) < 1 << (8 - LITERAL_NAME_SHIFT), "name length does not fit the literal");
+
+static size_t putVarint(uint8_t *out, uint64_t value)
+{
+  size_t n = 0;
+  while (value >= 0x80)
+  {
+    out[n++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+static bool getVarint(const uint8_t *data, size_t &offset, uint64_t &value)
+{
+  value = 0;
+  for (unsigned int shift = 0; shift < 64 && offset < CARD_HISTORY_BLOCK_SIZE; shift += 7)
+  {
+    uint8_t byte = data[offset++];
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Reads the fields of the facility literal at offset, past its head and name
+static bool readFacility(const uint8_t *data, size_t offset, uint8_t &formatId, uint8_t &reader, uint64_t &code, uint64_t &cardNumber)
+{
+  offset += 1 + (data[offset] >> LITERAL_NAME_SHIFT);
+  if (offset + 2 > CARD_HISTORY_BLOCK_SIZE)
+  {
+    return false;
+  }
+  formatId = data[offset];
+  reader = data[offset + 1];
+  offset += 2;
+  return getVarint(data, offset, code) && getVarint(data, offset, cardNumber);
+}
+
+// Fills the card fields of record from the literal at offset and moves
+// offset past it; facilities are the facility literals of the block so far.
+// The data may be changing underneath, so every length is checked against
+// the block.
+static bool decodeLiteral(const uint8_t *data, size_t &offset, CardRecord &record, const uint16_t *facilities, uint8_t facilityCount)
+{
+  if (offset >= CARD_HISTORY_BLOCK_SIZE)
+  {
+    return false;
+  }
+  uint8_t kind = data[offset] & LITERAL_KIND_MASK;
+  size_t nameLength = data[offset] >> LITERAL_NAME_SHIFT;
+  size_t head = offset++;
+  if (nameLength > sizeof(record.name) || offset + nameLength > CARD_HISTORY_BLOCK_SIZE)
+  {
+    return false;
+  }
+  memset(record.name, 0, sizeof(record.name));
+  memcpy(record.name, data + offset, nameLength);
+  offset += nameLength;
+
+  if (kind == LITERAL_FRAME)
+  {
+    if (offset + 3 > CARD_HISTORY_BLOCK_SIZE)
+    {
+      return false;
+    }
+    uint8_t bitCount = data[offset];
+    size_t byteCount = (bitCount + 7u) / 8;
+    record.formatId = data[offset + 1];
+    record.reader = data[offset + 2];
+    offset += 3;
+    if (bitCount > MAX_BITS || offset + byteCount > CARD_HISTORY_BLOCK_SIZE)
+    {
+      return false;
+    }
+    record.bitCount = bitCount;
+    memset(record.bits, 0, sizeof(record.bits));
+    for (size_t i = 0; i < byteCount; i++)
+    {
+      record.bits[i / 4] |= (uint32_t)data[offset++] << (24 - 8 * (i % 4));
+    }
+
+    // the codes are not stored, the frame holds them
+    const CardFormat *format = cardFormatById(record.formatId);
+    WiegandFrame frame;
+    record.getFrame(frame);
+    record.facilityCode = format != nullptr ? decodeFacilityCode(frame, *format) : 0;
+    record.cardNumber = format != nullptr ? decodeCardNumber(frame, *format) : 0;
+    return true;
+  }
+
+  // the frame is not stored, the fields rebuild it
+  uint64_t cardNumber;
+  if (kind == LITERAL_FACILITY)
+  {
+    if (!readFacility(data, head, record.formatId, record.reader, record.facilityCode, cardNumber))
+    {
+      return false;
+    }
+    // the literal ends after the two varints
+    uint64_t skipped;
+    offset += 2;
+    if (!getVarint(data, offset, skipped) || !getVarint(data, offset, skipped))
+    {
+      return false;
+    }
+  }
+  else if (kind == LITERAL_MEMBER)
+  {
+    uint64_t index, difference;
+    if (!getVarint(data, offset, index) || !getVarint(data, offset, difference) || index >= facilityCount ||
+        !readFacility(data, facilities[index], record.formatId, record.reader, record.facilityCode, cardNumber))
+    {
+      return false;
+    }
+    cardNumber += (uint64_t)unzigzag(difference);
+  }
+  else
+  {
+    return false;
+  }
+
+  const CardFormat *format = cardFormatById(record.formatId);
+  if (format == nullptr)
+  {
+    return false;
+  }
+  WiegandFrame frame;
+  encodeCardFrame(*format, record.facilityCode, cardNumber, frame);
+  record.setFrame(frame);
+  record.cardNumber = cardNumber;
+  return true;
+}
+
+void CardRecord::setFrame(const WiegandFrame &frame)
+{
+  bitCount = frame.bitCount < MAX_BITS ? frame.bitCount : MAX_BITS;
+  for (unsigned int i = 0; i < FRAME_WORDS; i++)
+  {
+    bits[i] = frame.words[i];
+  }
+}
+
+void CardRecord::getFrame(WiegandFrame &frame) const
+{
+  for (unsigned int i = 0; i < FRAME_WORDS; i++)
+  {
+    frame.words[i] = bits[i];
+  }
+  frame.bitCount = bitCount;
+}
+
+const char *cardStatusName(CardStatus status)
+{
+  switch (status)
+  {
+  case CARD_READ:
+    return "Read";
+  case CARD_AUTHORIZED:
+    return "Authorized";
+  case CARD_UNAUTHORIZED:
+    return "Unauthorized";
+  case CARD_PARITY_ERROR:
+    return "Parity Error";
+  }
+  return "";
+}
+
+size_t CardHistory::encodeLiteral(const CardRecord &record, uint8_t *out) const
+{
+  size_t nameLength = record.status == CARD_AUTHORIZED ? strnlen(record.name, sizeof(record.name)) : 0;
+  size_t n = 1;
+  memcpy(out + n, record.name, nameLength);
+  n += nameLength;
+
+  // a card of a known format whose fields rebuild the exact frame, parity
+  // included, is stored as its fields
+  const CardFormat *format = cardFormatById(record.formatId);
+  WiegandFrame frame, rebuilt;
+  record.getFrame(frame);
+  uint64_t code = 0, cardNumber = 0;
+  bool coded = false;
+  if (format != nullptr && format->bitCount == record.bitCount)
+  {
+    code = decodeFacilityCode(frame, *format);
+    cardNumber = decodeCardNumber(frame, *format);
+    encodeCardFrame(*format, code, cardNumber, rebuilt);
+    coded = memcmp(frame.words, rebuilt.words, sizeof(frame.words)) == 0;
+  }
+
+  if (coded)
+  {
+    for (uint8_t i = 0; i < facilityCount; i++)
+    {
+      const Facility &facility = facilities[i];
+      // the first card of a facility is written the same again, so that it
+      // matches its own literal
+      if (facility.formatId == record.formatId && facility.reader == record.reader && facility.code == code &&
+          facility.firstCard != cardNumber)
+      {
+        out[0] = LITERAL_MEMBER | nameLength << LITERAL_NAME_SHIFT;
+        n += putVarint(out + n, i);
+        n += putVarint(out + n, zigzag((int64_t)(cardNumber - facility.firstCard)));
+        return n;
+      }
+    }
+    out[0] = LITERAL_FACILITY | nameLength << LITERAL_NAME_SHIFT;
+    out[n++] = record.formatId;
+    out[n++] = record.reader;
+    n += putVarint(out + n, code);
+    n += putVarint(out + n, cardNumber);
+    return n;
+  }
+
+  out[0] = LITERAL_FRAME | nameLength << LITERAL_NAME_SHIFT;
+  out[n++] = record.bitCount;
+  out[n++] = record.formatId;
+  out[n++] = record.reader;
+  // frame bits in reading order, the last byte padded with zeros
+  for (unsigned int i = 0; i < (record.bitCount + 7u) / 8; i++)
+  {
+    out[n++] = record.bits[i / 4] >> (24 - 8 * (i % 4));
+  }
+  return n;
+}
+
+size_t CardHistory::encode(const CardRecord &record, int64_t time, uint8_t *out, size_t &literalOffset) const
+{
+  uint8_t literal[LITERAL_MAX_SIZE];
+  size_t literalSize = encodeLiteral(record, literal);
+
+  // the same card read earlier in this block, identical literals only
+  int match = -1;
+  for (uint8_t i = 0; i < literalCount && match < 0; i++)
+  {
+    if (literals[i] + literalSize <= used && memcmp(blocks[tail].data + literals[i], literal, literalSize) == 0)
+    {
+      match = i;
+    }
+  }
+
+  size_t n = 1;
+  // reads arrive in time order, anything else is clamped to the previous one
+  n += putVarint(out + n, time > lastTime ? time - lastTime : 0);
+  literalOffset = 0;
+  if (match < 0)
+  {
+    out[0] = record.status | TAG_LITERAL;
+    literalOffset = n;
+    memcpy(out + n, literal, literalSize);
+    n += literalSize;
+  }
+  else if (match < TAG_INDEX_ESCAPE)
+  {
+    out[0] = record.status | match << TAG_INDEX_SHIFT;
+  }
+  else
+  {
+    out[0] = record.status | TAG_INDEX_ESCAPE << TAG_INDEX_SHIFT;
+    n += putVarint(out + n, match - TAG_INDEX_ESCAPE);
+  }
+  return n;
+}
+
+void CardHistory::startBlock(uint32_t sequence, int64_t time)
+{
+  tail = (tail + 1) % CARD_HISTORY_BLOCKS;
+  Block &block = blocks[tail];
+
+  // invalidate the block while it is rewritten
+  block.first.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  block.count.store(0, std::memory_order_relaxed);
+  block.baseTime = time;
+  block.first.store(sequence, std::memory_order_release);
+
+  used = 0;
+  lastTime = time;
+  literalCount = 0;
+  facilityCount = 0;
+}
+
+uint32_t CardHistory::add(CardRecord &record)
+{
+  uint32_t sequence = next.load(std::memory_order_relaxed);
+  int64_t time = record.timestamp / 1000;
+  record.sequence = sequence;
+
+  uint8_t encoded[RECORD_MAX_SIZE];
+  size_t literalOffset;
+  size_t size = 0;
+  if (tail >= 0)
+  {
+    size = encode(record, time, encoded, literalOffset);
+  }
+  if (tail < 0 || used + size > CARD_HISTORY_BLOCK_SIZE)
+  {
+    startBlock(sequence, time);
+    size = encode(record, time, encoded, literalOffset);
+  }
+
+  Block &block = blocks[tail];
+  memcpy(block.data + used, encoded, size);
+  if (literalOffset > 0 && literalCount < CARD_HISTORY_DICTIONARY)
+  {
+    literals[literalCount++] = used + literalOffset;
+  }
+  if (literalOffset > 0 && (encoded[literalOffset] & LITERAL_KIND_MASK) == LITERAL_FACILITY &&
+      facilityCount < CARD_HISTORY_FACILITIES)
+  {
+    Facility &facility = facilities[facilityCount++];
+    readFacility(block.data, used + literalOffset, facility.formatId, facility.reader, facility.code, facility.firstCard);
+  }
+  used += size;
+  if (time > lastTime)
+  {
+    lastTime = time;
+  }
+  // publish the record to the readers of the block
+  block.count.store(block.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  next.store(sequence + 1, std::memory_order_release);
+  return sequence;
+}
+
+bool CardHistory::get(uint32_t sequence, CardRecord &record) const
+{
+  Cursor cursor(*this, sequence);
+  return cursor.next(record) && record.sequence == sequence;
+}
+
+uint32_t CardHistory::firstSequence() const
+{
+  uint32_t oldest = next.load(std::memory_order_acquire);
+  for (unsigned int i = 0; i < CARD_HISTORY_BLOCKS; i++)
+  {
+    uint32_t first = blocks[i].first.load(std::memory_order_acquire);
+    if (first != 0 && first < oldest)
+    {
+      oldest = first;
+    }
+  }
+  return oldest;
+}
+
+uint32_t CardHistory::nextSequence() const
+{
+  return next.load(std::memory_order_acquire);
+}
+
+size_t CardHistory::memoryUsage() const
+{
+  return sizeof(blocks);
+}
+
+CardHistory::Cursor::Cursor(const CardHistory &history, uint32_t from) : history(history), sequence(from)
+{
+}
+
+bool CardHistory::Cursor::decode(const Block &current, CardRecord &record)
+{
+  const uint8_t *data = current.data;
+  size_t at = offset;
+  if (at >= CARD_HISTORY_BLOCK_SIZE)
+  {
+    return false;
+  }
+  uint8_t tag = data[at++];
+  uint64_t delta;
+  if (!getVarint(data, at, delta))
+  {
+    return false;
+  }
+
+  if (tag & TAG_LITERAL)
+  {
+    size_t literal = at;
+    if (!decodeLiteral(data, at, record, facilities, facilityCount))
+    {
+      return false;
+    }
+    if (literalCount < CARD_HISTORY_DICTIONARY)
+    {
+      literals[literalCount++] = literal;
+    }
+    if ((data[literal] & LITERAL_KIND_MASK) == LITERAL_FACILITY && facilityCount < CARD_HISTORY_FACILITIES)
+    {
+      facilities[facilityCount++] = literal;
+    }
+  }
+  else
+  {
+    uint64_t index = tag >> TAG_INDEX_SHIFT;
+    if (index == TAG_INDEX_ESCAPE)
+    {
+      uint64_t extra;
+      if (!getVarint(data, at, extra))
+      {
+        return false;
+      }
+      index += extra;
+    }
+    size_t literal = index < literalCount ? literals[index] : CARD_HISTORY_BLOCK_SIZE;
+    if (!decodeLiteral(data, literal, record, facilities, facilityCount))
+    {
+      return false;
+    }
+  }
+
+  time += delta;
+  record.status = (CardStatus)(tag & TAG_STATUS_MASK);
+  record.timestamp = time * 1000;
+  offset = at;
+  return true;
+}
+
+bool CardHistory::Cursor::seek()
+{
+  uint32_t oldest = history.firstSequence();
+  if (sequence < oldest)
+  {
+    sequence = oldest;
+  }
+
+  for (int i = 0; i < CARD_HISTORY_BLOCKS; i++)
+  {
+    const Block &candidate = history.blocks[i];
+    uint32_t first = candidate.first.load(std::memory_order_acquire);
+    uint16_t count = candidate.count.load(std::memory_order_acquire);
+    if (first == 0 || sequence < first || sequence - first >= count)
+    {
+      continue;
+    }
+
+    // decode the block from its start up to the sequence
+    block = i;
+    blockFirst = first;
+    index = 0;
+    offset = 0;
+    time = candidate.baseTime;
+    literalCount = 0;
+    facilityCount = 0;
+    CardRecord skipped;
+    bool decoded = true;
+    while (decoded && index < sequence - first)
+    {
+      decoded = decode(candidate, skipped);
+      index++;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!decoded || candidate.first.load(std::memory_order_relaxed) != first)
+    {
+      block = -1;
+    }
+    return block >= 0;
+  }
+  return false;
+}
+
+bool CardHistory::Cursor::next(CardRecord &record)
+{
+  // every retry means the writer reused the block under the cursor
+  for (int attempt = 0; attempt < 4; attempt++)
+  {
+    if (block < 0 && !seek())
+    {
+      if (sequence >= history.nextSequence())
+      {
+        return false;
+      }
+      continue;
+    }
+
+    const Block &current = history.blocks[block];
+    if (index >= current.count.load(std::memory_order_acquire))
+    {
+      // the block is done, the records go on in the next one
+      if (sequence >= history.nextSequence())
+      {
+        return false;
+      }
+      block = -1;
+      continue;
+    }
+
+    bool decoded = decode(current, record);
+    // the record only counts when the block was not reused meanwhile
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!decoded || current.first.load(std::memory_order_relaxed) != blockFirst)
+    {
+      block = -1;
+      continue;
+    }
+    record.sequence = sequence++;
+    index++;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,567 @@
+#include "credential_db.h"
+#include "credential_index.h"
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// file header, followed by the records sorted by key
+struct CredentialDbHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t generation;
+};
+
+static const uint32_t CREDENTIAL_DB_MAGIC = 0x42445344; // "DSDB"
+static const uint16_t CREDENTIAL_DB_VERSION = 2;
+// version 1 files end the header before the generation
+static const size_t CREDENTIAL_DB_V1_HEADER = offsetof(CredentialDbHeader, generation);
+
+// Boot snapshot next to every generation file: the Bloom filter bits and the
+// sparse index, so opening the database reads them back instead of scanning
+// every record. Written whenever a generation is scanned, ignored unless it
+// matches the generation file.
+struct CredentialIndexHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t probes;
+  uint32_t generation;
+  uint32_t recordCount;
+  uint32_t bloomBytes;
+  uint32_t sparseCount;
+};
+
+static const uint32_t CREDENTIAL_INDEX_MAGIC = 0x58425344; // "DSBX"
+static const uint16_t CREDENTIAL_INDEX_VERSION = 1;
+
+static String indexPath(const String &filePath)
+{
+  return filePath + ".idx";
+}
+
+CredentialImage::~CredentialImage()
+{
+  delete[] sparse;
+}
+
+size_t CredentialImage::count() const
+{
+  return recordCount;
+}
+
+bool CredentialImage::mayContain(uint64_t facilityCode, uint64_t cardNumber) const
+{
+  return recordCount > 0 && bloom.mayContain(credentialHash(facilityCode, cardNumber));
+}
+
+bool CredentialImage::read(File &in, size_t index, Credential &credential) const
+{
+  return index < recordCount && in.seek(dataOffset + index * sizeof(Credential)) &&
+         in.read((uint8_t *)&credential, sizeof(credential)) == sizeof(credential);
+}
+
+bool CredentialImage::find(File &in, uint64_t facilityCode, uint64_t cardNumber, Credential &credential) const
+{
+  if (!mayContain(facilityCode, cardNumber))
+  {
+    return false;
+  }
+
+  // last block whose first key is not above the key
+  size_t low = 0;
+  size_t high = sparseCount;
+  while (low < high)
+  {
+    size_t mid = (low + high) / 2;
+    if (credentialKeyLess(facilityCode, cardNumber, sparse[mid].facilityCode, sparse[mid].cardNumber))
+    {
+      high = mid;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+  if (low == 0)
+  {
+    return false;
+  }
+
+  // binary search inside the block, the reads stay within the same flash pages
+  size_t first = (low - 1) * CREDENTIAL_DB_STRIDE;
+  low = first;
+  high = min(first + CREDENTIAL_DB_STRIDE, recordCount);
+  while (low < high)
+  {
+    size_t mid = (low + high) / 2;
+    if (!read(in, mid, credential))
+    {
+      return false;
+    }
+    if (credential.facilityCode == facilityCode && credential.cardNumber == cardNumber)
+    {
+      return true;
+    }
+    if (credentialKeyLess(credential.facilityCode, credential.cardNumber, facilityCode, cardNumber))
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+size_t CredentialImage::lowerBound(File &in, uint64_t facilityCode, uint64_t cardNumber) const
+{
+  // last block whose first key is not above the key
+  size_t low = 0;
+  size_t high = sparseCount;
+  while (low < high)
+  {
+    size_t mid = (low + high) / 2;
+    if (credentialKeyLess(facilityCode, cardNumber, sparse[mid].facilityCode, sparse[mid].cardNumber))
+    {
+      high = mid;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+  if (low == 0)
+  {
+    return 0;
+  }
+
+  // the next block starts above the key, so the answer is inside this one or
+  // right after it
+  size_t first = (low - 1) * CREDENTIAL_DB_STRIDE;
+  low = first;
+  high = min(first + CREDENTIAL_DB_STRIDE, recordCount);
+  Credential credential;
+  while (low < high)
+  {
+    size_t mid = (low + high) / 2;
+    if (!read(in, mid, credential))
+    {
+      return recordCount;
+    }
+    if (credentialKeyLess(credential.facilityCode, credential.cardNumber, facilityCode, cardNumber))
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+const char *CredentialImage::path() const
+{
+  return filePath.c_str();
+}
+
+size_t CredentialImage::memoryUsage() const
+{
+  return bloom.sizeBytes() + sparseCount * sizeof(Key);
+}
+
+CredentialDb::~CredentialDb()
+{
+  end();
+}
+
+// even generations live in path, odd ones next to it
+String CredentialDb::slotPath(uint32_t generation) const
+{
+  return (generation & 1) ? String(path) + ".1" : String(path);
+}
+
+bool CredentialDb::begin(fs::FS &fs, const char *path)
+{
+  end();
+  this->fs = &fs;
+  this->path = path;
+
+  // newest complete generation of the two files; a leftover temp file is
+  // from a merge that did not complete
+  for (uint32_t slot = 0; slot < 2; slot++)
+  {
+    String temp = slotPath(slot) + ".tmp";
+    if (fs.exists(temp))
+    {
+      fs.remove(temp);
+    }
+    String candidate = slotPath(slot);
+    CredentialImage *image = fs.exists(candidate) ? load(candidate) : nullptr;
+    if (image == nullptr)
+    {
+      continue;
+    }
+    if (current == nullptr || image->generation > current->generation)
+    {
+      std::swap(current, image);
+    }
+    if (image != nullptr)
+    {
+      // a merge stopped before the older generation was removed
+      String stale = image->filePath;
+      delete image;
+      fs.remove(stale);
+      fs.remove(indexPath(stale));
+    }
+  }
+
+  if (current == nullptr)
+  {
+    if (fs.exists(path))
+    {
+      // don't overwrite a file that could not be read
+      return false;
+    }
+    File out = fs.open(path, "w");
+    if (!out)
+    {
+      return false;
+    }
+    CredentialDbHeader header = {CREDENTIAL_DB_MAGIC, CREDENTIAL_DB_VERSION, sizeof(Credential), 0};
+    out.write((const uint8_t *)&header, sizeof(header));
+    out.close();
+    current = load(path);
+    if (current == nullptr)
+    {
+      return false;
+    }
+  }
+
+  file = fs.open(current->filePath, "r");
+  return (bool)file;
+}
+
+void CredentialDb::end()
+{
+  if (file)
+  {
+    file.close();
+  }
+  delete current;
+  current = nullptr;
+  delete retired;
+  retired = nullptr;
+}
+
+// Reads the header of a file and its boot snapshot, or scans the file once
+// to build the Bloom filter and the sparse index and writes the snapshot
+CredentialImage *CredentialDb::load(const String &filePath)
+{
+  File in = fs->open(filePath, "r");
+  if (!in)
+  {
+    return nullptr;
+  }
+
+  CredentialDbHeader header = {};
+  if (in.read((uint8_t *)&header, CREDENTIAL_DB_V1_HEADER) != CREDENTIAL_DB_V1_HEADER || header.magic != CREDENTIAL_DB_MAGIC ||
+      header.recordSize != sizeof(Credential))
+  {
+    return nullptr;
+  }
+  size_t dataOffset = CREDENTIAL_DB_V1_HEADER;
+  if (header.version == CREDENTIAL_DB_VERSION)
+  {
+    if (in.read((uint8_t *)&header.generation, sizeof(header.generation)) != sizeof(header.generation))
+    {
+      return nullptr;
+    }
+    dataOffset = sizeof(header);
+  }
+  else if (header.version != 1)
+  {
+    return nullptr;
+  }
+
+  CredentialImage *image = new (std::nothrow) CredentialImage();
+  if (image == nullptr)
+  {
+    return nullptr;
+  }
+  image->filePath = filePath;
+  image->generation = header.generation;
+  image->dataOffset = dataOffset;
+  image->recordCount = (in.size() - dataOffset) / sizeof(Credential);
+  image->sparseCount = (image->recordCount + CREDENTIAL_DB_STRIDE - 1) / CREDENTIAL_DB_STRIDE;
+  if (image->sparseCount > 0)
+  {
+    image->sparse = new (std::nothrow) CredentialImage::Key[image->sparseCount];
+  }
+  if ((image->sparseCount > 0 && image->sparse == nullptr) || !image->bloom.begin(image->recordCount))
+  {
+    delete image;
+    return nullptr;
+  }
+  if (loadIndex(*image))
+  {
+    return image;
+  }
+
+  // the filter sized for recordCount starts out empty
+  Credential credential;
+  for (size_t i = 0; i < image->recordCount; i++)
+  {
+    if (in.read((uint8_t *)&credential, sizeof(credential)) != sizeof(credential))
+    {
+      delete image;
+      return nullptr;
+    }
+    image->bloom.add(credentialHash(credential.facilityCode, credential.cardNumber));
+    if (i % CREDENTIAL_DB_STRIDE == 0)
+    {
+      image->sparse[i / CREDENTIAL_DB_STRIDE] = {credential.facilityCode, credential.cardNumber};
+    }
+  }
+  saveIndex(*image);
+  return image;
+}
+
+// fills the filter and the sparse index of an image sized for its file from
+// the boot snapshot, false when there is none for this generation
+bool CredentialDb::loadIndex(CredentialImage &image)
+{
+  String snapshot = indexPath(image.filePath);
+  if (!fs->exists(snapshot))
+  {
+    return false;
+  }
+  File in = fs->open(snapshot, "r");
+  if (!in)
+  {
+    return false;
+  }
+
+  CredentialIndexHeader header = {};
+  size_t sparseBytes = image.sparseCount * sizeof(CredentialImage::Key);
+  if (in.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.magic != CREDENTIAL_INDEX_MAGIC ||
+      header.version != CREDENTIAL_INDEX_VERSION || header.probes != BLOOM_PROBES || header.generation != image.generation ||
+      header.recordCount != image.recordCount || header.bloomBytes != image.bloom.sizeBytes() || header.sparseCount != image.sparseCount ||
+      in.size() != sizeof(header) + header.bloomBytes + sparseBytes)
+  {
+    return false;
+  }
+  if (in.read(image.bloom.data(), header.bloomBytes) != header.bloomBytes ||
+      (sparseBytes > 0 && in.read((uint8_t *)image.sparse, sparseBytes) != sparseBytes))
+  {
+    // a filter read halfway would answer wrongly, the scan starts over
+    image.bloom.clear();
+    return false;
+  }
+  return true;
+}
+
+// LittleFS only replaces the file on close, a snapshot is never left torn
+void CredentialDb::saveIndex(const CredentialImage &image)
+{
+  File out = fs->open(indexPath(image.filePath), "w");
+  if (!out)
+  {
+    return;
+  }
+  CredentialIndexHeader header = {};
+  header.magic = CREDENTIAL_INDEX_MAGIC;
+  header.version = CREDENTIAL_INDEX_VERSION;
+  header.probes = BLOOM_PROBES;
+  header.generation = image.generation;
+  header.recordCount = image.recordCount;
+  header.bloomBytes = image.bloom.sizeBytes();
+  header.sparseCount = image.sparseCount;
+  size_t sparseBytes = image.sparseCount * sizeof(CredentialImage::Key);
+  bool ok = out.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+            out.write(image.bloom.data(), header.bloomBytes) == header.bloomBytes &&
+            (sparseBytes == 0 || out.write((const uint8_t *)image.sparse, sparseBytes) == sparseBytes);
+  out.close();
+  if (!ok)
+  {
+    fs->remove(indexPath(image.filePath));
+  }
+}
+
+size_t CredentialDb::count() const
+{
+  return current != nullptr ? current->count() : 0;
+}
+
+bool CredentialDb::mayContain(uint64_t facilityCode, uint64_t cardNumber) const
+{
+  return current != nullptr && current->mayContain(facilityCode, cardNumber);
+}
+
+bool CredentialDb::read(size_t index, Credential &credential)
+{
+  return current != nullptr && current->read(file, index, credential);
+}
+
+size_t CredentialDb::lowerBound(uint64_t facilityCode, uint64_t cardNumber)
+{
+  return current != nullptr ? current->lowerBound(file, facilityCode, cardNumber) : 0;
+}
+
+bool CredentialDb::find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential)
+{
+  return current != nullptr && current->find(file, facilityCode, cardNumber, credential);
+}
+
+const CredentialImage *CredentialDb::image() const
+{
+  return current;
+}
+
+void CredentialDb::release()
+{
+  if (retired == nullptr)
+  {
+    return;
+  }
+  String stale = retired->filePath;
+  delete retired;
+  retired = nullptr;
+  fs->remove(stale);
+  fs->remove(indexPath(stale));
+}
+
+// a sorted array of changes
+class CredentialArraySource : public CredentialSource
+{
+public:
+  CredentialArraySource(const Credential *changes, size_t count) : changes(changes), count(count)
+  {
+  }
+
+  bool next(Credential &credential) override
+  {
+    if (used >= count)
+    {
+      return false;
+    }
+    credential = changes[used++];
+    return true;
+  }
+
+private:
+  const Credential *changes;
+  size_t count;
+  size_t used = 0;
+};
+
+bool CredentialDb::merge(const Credential *changes, size_t changeCount)
+{
+  CredentialArraySource source(changes, changeCount);
+  return merge(source);
+}
+
+bool CredentialDb::merge(CredentialSource &changes)
+{
+  if (current == nullptr || retired != nullptr)
+  {
+    return false;
+  }
+
+  uint32_t generation = current->generation + 1;
+  String target = slotPath(generation);
+  String temp = target + ".tmp";
+  File out = fs->open(temp, "w");
+  if (!out)
+  {
+    return false;
+  }
+
+  CredentialDbHeader header = {CREDENTIAL_DB_MAGIC, CREDENTIAL_DB_VERSION, sizeof(Credential), generation};
+  bool ok = out.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+
+  // both inputs are sorted, write the smaller key first; on equal keys the
+  // change replaces the stored record
+  // a record that cannot be read drops the merge, taking it for the end of
+  // the database would lose every credential after it
+  size_t recordCount = current->count();
+  size_t i = 0;
+  Credential stored;
+  bool haveStored = recordCount > 0 && current->read(file, 0, stored);
+  ok = ok && haveStored == (recordCount > 0);
+  Credential change;
+  bool haveChange = changes.next(change);
+  while (ok && (haveStored || haveChange))
+  {
+    const Credential *next;
+    if (!haveChange || (haveStored && credentialKeyLess(stored.facilityCode, stored.cardNumber, change.facilityCode, change.cardNumber)))
+    {
+      next = &stored;
+    }
+    else
+    {
+      if (haveStored && stored.facilityCode == change.facilityCode && stored.cardNumber == change.cardNumber)
+      {
+        // skip the stored record, the change takes its place
+        i++;
+        haveStored = i < recordCount && file.read((uint8_t *)&stored, sizeof(stored)) == sizeof(stored);
+        ok = haveStored == (i < recordCount);
+      }
+      if (change.flags & CREDENTIAL_DELETED)
+      {
+        haveChange = changes.next(change);
+        continue;
+      }
+      next = &change;
+    }
+
+    ok = ok && out.write((const uint8_t *)next, sizeof(Credential)) == sizeof(Credential);
+    if (next == &stored)
+    {
+      i++;
+      haveStored = i < recordCount && file.read((uint8_t *)&stored, sizeof(stored)) == sizeof(stored);
+      ok = ok && haveStored == (i < recordCount);
+    }
+    else
+    {
+      haveChange = changes.next(change);
+    }
+  }
+  ok = ok && !changes.failed();
+  out.close();
+
+  // the target slot may still hold a generation older than the current one
+  if (ok && fs->exists(target))
+  {
+    fs->remove(target);
+  }
+  if (!ok || !fs->rename(temp, target))
+  {
+    fs->remove(temp);
+    return false;
+  }
+
+  CredentialImage *image = load(target);
+  if (image == nullptr)
+  {
+    fs->remove(target);
+    fs->remove(indexPath(target));
+    return false;
+  }
+
+  // readers may still use the current generation until release()
+  file.close();
+  file = fs->open(target, "r");
+  retired = current;
+  current = image;
+  return true;
+}
+
+size_t CredentialDb::memoryUsage() const
+{
+  return (current != nullptr ? current->memoryUsage() : 0) + (retired != nullptr ? retired->memoryUsage() : 0);
+}
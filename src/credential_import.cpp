@@ -0,0 +1,331 @@
+#include "credential_import.h"
+#include "ArduinoJson.h"
+
+// parses a whole decimal number, surrounding spaces and quotes allowed
+static bool parseNumber(const char *text, uint64_t &value)
+{
+  while (*text == ' ' || *text == '"' || *text == '\t')
+  {
+    text++;
+  }
+  if (*text < '0' || *text > '9')
+  {
+    return false;
+  }
+  char *end;
+  value = strtoull(text, &end, 10);
+  while (*end == ' ' || *end == '"' || *end == '\t' || *end == '\r')
+  {
+    end++;
+  }
+  return *end == '\0';
+}
+
+bool CredentialImporter::begin(CredentialStore &store)
+{
+  if (!store.beginBatch())
+  {
+    return false;
+  }
+  this->store = &store;
+  format = UNKNOWN;
+  length = 0;
+  overflow = false;
+  firstLine = true;
+  depth = 0;
+  listDepth = 0;
+  topObject = false;
+  inCredential = false;
+  inString = false;
+  escaped = false;
+  keyLength = 0;
+  added = 0;
+  duplicate = 0;
+  rejected = 0;
+  return true;
+}
+
+bool CredentialImporter::active() const
+{
+  return store != nullptr;
+}
+
+void CredentialImporter::feed(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len && store != nullptr; i++)
+  {
+    char c = data[i];
+    if (format == UNKNOWN)
+    {
+      // the first character tells the format apart
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+      {
+        continue;
+      }
+      format = (c == '[' || c == '{') ? JSON : CSV;
+    }
+
+    if (format == CSV)
+    {
+      feedCsv(c);
+    }
+    else
+    {
+      feedJson(c);
+    }
+  }
+}
+
+void CredentialImporter::append(char c)
+{
+  if (length < IMPORT_RECORD_SIZE - 1)
+  {
+    record[length++] = c;
+  }
+  else
+  {
+    overflow = true;
+  }
+}
+
+void CredentialImporter::feedCsv(char c)
+{
+  if (c == '\n')
+  {
+    importCsvLine();
+    length = 0;
+    overflow = false;
+    return;
+  }
+  append(c);
+}
+
+void CredentialImporter::importCsvLine()
+{
+  record[length] = '\0';
+  bool header = firstLine;
+  firstLine = false;
+
+  // skip blank lines
+  size_t start = 0;
+  while (record[start] == ' ' || record[start] == '\t' || record[start] == '\r')
+  {
+    start++;
+  }
+  if (record[start] == '\0')
+  {
+    return;
+  }
+  if (overflow)
+  {
+    rejected++;
+    return;
+  }
+
+  char *fields[3] = {record + start, nullptr, nullptr};
+  for (int f = 1; f < 3; f++)
+  {
+    char *comma = strchr(fields[f - 1], ',');
+    if (comma == nullptr)
+    {
+      break;
+    }
+    *comma = '\0';
+    fields[f] = comma + 1;
+  }
+
+  // a first line that does not start with a number is a header
+  uint64_t value;
+  if (header && !parseNumber(fields[0], value))
+  {
+    return;
+  }
+
+  // unquote the name
+  char *name = fields[2] != nullptr ? fields[2] : (char *)"";
+  while (*name == ' ' || *name == '"')
+  {
+    name++;
+  }
+  size_t nameLength = strlen(name);
+  while (nameLength > 0 && (name[nameLength - 1] == '"' || name[nameLength - 1] == '\r' || name[nameLength - 1] == ' '))
+  {
+    name[--nameLength] = '\0';
+  }
+  importRecord(fields[0], fields[1], name);
+}
+
+bool CredentialImporter::credentialMember() const
+{
+  return (keyLength == 5 && memcmp(key, "users", 5) == 0) || (keyLength == 11 && memcmp(key, "credentials", 11) == 0);
+}
+
+void CredentialImporter::feedJson(char c)
+{
+  if (inCredential)
+  {
+    append(c);
+  }
+  if (inString)
+  {
+    if (c == '"' && !escaped)
+    {
+      inString = false;
+    }
+    else if (depth == 1 && keyLength < sizeof(key))
+    {
+      key[keyLength++] = c;
+    }
+    escaped = !escaped && c == '\\';
+    return;
+  }
+
+  switch (c)
+  {
+  case '"':
+    inString = true;
+    escaped = false;
+    keyLength = 0;
+    break;
+  case '[':
+  case '{':
+    depth++;
+    if (depth == 1)
+    {
+      topObject = c == '{';
+    }
+    if (c == '[' && listDepth == 0 && (depth == 1 ? !topObject : depth == 2 && topObject && credentialMember()))
+    {
+      listDepth = depth;
+    }
+    else if (c == '{' && !inCredential && listDepth > 0 && depth == listDepth + 1)
+    {
+      // a credential, with whatever it nests
+      inCredential = true;
+      length = 0;
+      overflow = false;
+      append(c);
+    }
+    break;
+  case ']':
+  case '}':
+    if (inCredential && depth == listDepth + 1)
+    {
+      importJsonObject();
+      inCredential = false;
+    }
+    if (depth == listDepth)
+    {
+      listDepth = 0;
+    }
+    if (depth > 0)
+    {
+      depth--;
+    }
+    break;
+  }
+}
+
+void CredentialImporter::importJsonObject()
+{
+  if (overflow)
+  {
+    rejected++;
+    return;
+  }
+
+  JsonDocument doc;
+  if (deserializeJson(doc, record, length))
+  {
+    rejected++;
+    return;
+  }
+
+  // numbers may be given as JSON numbers or as strings
+  char facilityCode[24];
+  char cardNumber[24];
+  JsonVariant fc = doc["facilityCode"];
+  JsonVariant cn = doc["cardNumber"];
+  if (fc.is<uint64_t>())
+  {
+    snprintf(facilityCode, sizeof(facilityCode), "%llu", fc.as<unsigned long long>());
+  }
+  else
+  {
+    snprintf(facilityCode, sizeof(facilityCode), "%s", fc | "");
+  }
+  if (cn.is<uint64_t>())
+  {
+    snprintf(cardNumber, sizeof(cardNumber), "%llu", cn.as<unsigned long long>());
+  }
+  else
+  {
+    snprintf(cardNumber, sizeof(cardNumber), "%s", cn | "");
+  }
+  importRecord(facilityCode, cardNumber, doc["name"] | "");
+}
+
+void CredentialImporter::importRecord(const char *facilityCode, const char *cardNumber, const char *name)
+{
+  uint64_t fc;
+  uint64_t cn;
+  if (facilityCode == nullptr || cardNumber == nullptr || !parseNumber(facilityCode, fc) || !parseNumber(cardNumber, cn))
+  {
+    rejected++;
+    return;
+  }
+
+  switch (store->batchAdd(fc, cn, name))
+  {
+  case BATCH_ADDED:
+    added++;
+    break;
+  case BATCH_DUPLICATE:
+    duplicate++;
+    break;
+  case BATCH_FAILED:
+    rejected++;
+    break;
+  }
+}
+
+void CredentialImporter::endInput()
+{
+  // a last CSV line without a line break
+  if (store != nullptr && format == CSV && length > 0)
+  {
+    importCsvLine();
+    length = 0;
+  }
+}
+
+bool CredentialImporter::finish()
+{
+  if (store == nullptr)
+  {
+    return false;
+  }
+  endInput();
+  bool ok = store->endBatch();
+
+  // keys given twice in the body are only found when the batch is merged
+  size_t repeated = store->batchDuplicates();
+  added -= repeated;
+  duplicate += repeated;
+  store = nullptr;
+  if (!ok)
+  {
+    rejected += added;
+    added = 0;
+  }
+  return ok;
+}
+
+void CredentialImporter::abort()
+{
+  if (store != nullptr)
+  {
+    store->abortBatch();
+    store = nullptr;
+  }
+}
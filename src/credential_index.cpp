@@ -0,0 +1,149 @@
+#include "credential_index.h"
+
+#include <new>
+
+// marks an empty bucket
+static const uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+
+CredentialIndex::~CredentialIndex()
+{
+  delete[] buckets;
+}
+
+bool CredentialIndex::begin(size_t capacity)
+{
+  // keep the load factor at or below 1/2
+  size_t size = 16;
+  while (size < capacity * 2)
+  {
+    size <<= 1;
+  }
+
+  delete[] buckets;
+  buckets = new (std::nothrow) Bucket[size];
+  if (buckets == nullptr)
+  {
+    mask = 0;
+    return false;
+  }
+  mask = size - 1;
+  clear();
+  return true;
+}
+
+void CredentialIndex::clear()
+{
+  if (buckets == nullptr)
+  {
+    return;
+  }
+  for (uint32_t i = 0; i <= mask; i++)
+  {
+    buckets[i].slot = EMPTY_SLOT;
+  }
+}
+
+uint64_t credentialHash(uint64_t facilityCode, uint64_t cardNumber)
+{
+  // splitmix64 finalizer over both halves of the key
+  uint64_t h = facilityCode * 0x9E3779B97F4A7C15ULL ^ cardNumber;
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
+
+int32_t CredentialIndex::find(uint64_t facilityCode, uint64_t cardNumber, const Credential *table) const
+{
+  if (buckets == nullptr)
+  {
+    return -1;
+  }
+  uint32_t keyHash = hash(facilityCode, cardNumber);
+  for (uint32_t i = keyHash & mask;; i = (i + 1) & mask)
+  {
+    const Bucket &bucket = buckets[i];
+    if (bucket.slot == EMPTY_SLOT)
+    {
+      return -1;
+    }
+    if (bucket.hash == keyHash && table[bucket.slot].facilityCode == facilityCode && table[bucket.slot].cardNumber == cardNumber)
+    {
+      return bucket.slot;
+    }
+  }
+}
+
+void CredentialIndex::insert(uint64_t facilityCode, uint64_t cardNumber, uint32_t slot)
+{
+  if (buckets == nullptr)
+  {
+    return;
+  }
+  uint32_t keyHash = hash(facilityCode, cardNumber);
+  uint32_t i = keyHash & mask;
+  while (buckets[i].slot != EMPTY_SLOT)
+  {
+    i = (i + 1) & mask;
+  }
+  buckets[i].hash = keyHash;
+  buckets[i].slot = slot;
+}
+
+int32_t CredentialIndex::findBucket(uint32_t keyHash, uint32_t slot) const
+{
+  for (uint32_t i = keyHash & mask;; i = (i + 1) & mask)
+  {
+    if (buckets[i].slot == EMPTY_SLOT)
+    {
+      return -1;
+    }
+    if (buckets[i].slot == slot)
+    {
+      return i;
+    }
+  }
+}
+
+void CredentialIndex::move(uint64_t facilityCode, uint64_t cardNumber, uint32_t from, uint32_t to)
+{
+  if (buckets == nullptr)
+  {
+    return;
+  }
+  int32_t i = findBucket(hash(facilityCode, cardNumber), from);
+  if (i >= 0)
+  {
+    buckets[i].slot = to;
+  }
+}
+
+void CredentialIndex::remove(uint64_t facilityCode, uint64_t cardNumber, uint32_t slot)
+{
+  if (buckets == nullptr)
+  {
+    return;
+  }
+  int32_t found = findBucket(hash(facilityCode, cardNumber), slot);
+  if (found < 0)
+  {
+    return;
+  }
+
+  // shift the following entries of the probe run back into the hole so no
+  // tombstone is needed
+  uint32_t hole = found;
+  for (uint32_t i = (hole + 1) & mask; buckets[i].slot != EMPTY_SLOT; i = (i + 1) & mask)
+  {
+    uint32_t home = buckets[i].hash & mask;
+    // the entry can move to the hole when its home is not in (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      buckets[hole] = buckets[i];
+      hole = i;
+    }
+  }
+  buckets[hole].slot = EMPTY_SLOT;
+}
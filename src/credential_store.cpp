@@ -0,0 +1,635 @@
+#include "credential_store.h"
+
+#include <algorithm>
+#include <new>
+
+static bool credentialLess(const Credential &a, const Credential &b)
+{
+  return credentialKeyLess(a.facilityCode, a.cardNumber, b.facilityCode, b.cardNumber);
+}
+
+bool CredentialStore::begin(fs::FS &fs, const char *path, const char *journalPath)
+{
+  this->fs = &fs;
+  this->journalPath = journalPath;
+  if (!index.begin(MAX_PENDING_CREDENTIALS))
+  {
+    return false;
+  }
+  pendingUsed = 0;
+  if (!db.begin(fs, path))
+  {
+    return false;
+  }
+  total = db.count();
+  // a batch that never reached endBatch() before a reboot
+  if (fs.exists(runPath()))
+  {
+    fs.remove(runPath());
+  }
+  replayJournal();
+  journal = fs.open(journalPath, "a");
+  return (bool)journal && publish();
+}
+
+// Reapplies the changes logged since the last compaction. Replaying a change
+// that already reached the snapshot is harmless, the merge is idempotent.
+void CredentialStore::replayJournal()
+{
+  File in = fs->open(journalPath, "r");
+  if (!in)
+  {
+    return;
+  }
+
+  replaying = true;
+  bool compacted = false;
+  Credential change;
+  // a torn record at the end of the file is ignored
+  while (in.read((uint8_t *)&change, sizeof(change)) == sizeof(change))
+  {
+    Credential existing;
+    bool exists = find(change.facilityCode, change.cardNumber, existing);
+    compacted |= pendingUsed >= MAX_PENDING_CREDENTIALS;
+    if (!makeRoom())
+    {
+      break;
+    }
+    put(change.facilityCode, change.cardNumber, change.name, change.flags);
+    if (change.flags & CREDENTIAL_DELETED)
+    {
+      total -= exists ? 1 : 0;
+    }
+    else
+    {
+      total += exists ? 0 : 1;
+    }
+  }
+  in.close();
+  replaying = false;
+
+  // the journal could not be truncated while it was read
+  if (compacted)
+  {
+    commit();
+  }
+}
+
+bool CredentialStore::find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential)
+{
+  int32_t slot = index.find(facilityCode, cardNumber, pending);
+  if (slot >= 0)
+  {
+    if (pending[slot].flags & CREDENTIAL_DELETED)
+    {
+      return false;
+    }
+    credential = pending[slot];
+    return true;
+  }
+  return db.find(facilityCode, cardNumber, credential);
+}
+
+bool CredentialStore::lookup(uint64_t facilityCode, uint64_t cardNumber, Credential &credential)
+{
+  // announce the reader before loading the table, publish() waits for it
+  readers.fetch_add(1);
+  CredentialTable *current = table.load();
+  bool found = current != nullptr && current->find(facilityCode, cardNumber, credential);
+  readers.fetch_sub(1);
+  return found;
+}
+
+// Builds a table from the pending changes and the current database
+// generation and swaps it in. A failed publish leaves readers on the previous
+// table, which may still use a generation a merge replaced, so no merge runs
+// until a publish got through.
+bool CredentialStore::publish()
+{
+  CredentialTable *next = new (std::nothrow) CredentialTable();
+  if (next == nullptr || !next->begin(*fs, *db.image(), pending, pendingUsed))
+  {
+    delete next;
+    unpublished = true;
+    return false;
+  }
+  unpublished = false;
+
+  CredentialTable *old = table.exchange(next);
+  // a lookup that may still use the old table has announced itself before
+  // loading it, so once readers drops to 0 nobody can
+  while (readers.load() != 0)
+  {
+    delay(1);
+  }
+  delete old;
+  // the old table was the last user of a replaced database generation
+  db.release();
+  return true;
+}
+
+bool CredentialStore::add(uint64_t facilityCode, uint64_t cardNumber, const char *name)
+{
+  Credential existing;
+  if (find(facilityCode, cardNumber, existing) || !makeRoom() || !append(facilityCode, cardNumber, name, 0))
+  {
+    return false;
+  }
+  put(facilityCode, cardNumber, name, 0);
+  total++;
+  publish();
+  return true;
+}
+
+bool CredentialStore::remove(uint64_t facilityCode, uint64_t cardNumber)
+{
+  Credential existing;
+  if (!find(facilityCode, cardNumber, existing) || !makeRoom() || !append(facilityCode, cardNumber, "", CREDENTIAL_DELETED))
+  {
+    return false;
+  }
+  put(facilityCode, cardNumber, "", CREDENTIAL_DELETED);
+  total--;
+  publish();
+  return true;
+}
+
+bool CredentialStore::append(uint64_t facilityCode, uint64_t cardNumber, const char *name, uint8_t flags)
+{
+  if (!journal)
+  {
+    return false;
+  }
+  Credential change = {};
+  change.facilityCode = facilityCode;
+  change.cardNumber = cardNumber;
+  strncpy(change.name, name, sizeof(change.name) - 1);
+  change.flags = flags;
+  if (journal.write((const uint8_t *)&change, sizeof(change)) != sizeof(change))
+  {
+    return false;
+  }
+  // flush commits the record to flash
+  journal.flush();
+  return true;
+}
+
+bool CredentialStore::resetJournal()
+{
+  if (journal)
+  {
+    journal.close();
+  }
+  fs->remove(journalPath);
+  journal = fs->open(journalPath, "a");
+  return (bool)journal;
+}
+
+// A full pending table rejects the change, compaction is left to the caller
+// in the background (see pendingFull()). Only the journal replay at boot
+// compacts inline.
+bool CredentialStore::makeRoom()
+{
+  return pendingUsed < MAX_PENDING_CREDENTIALS || (replaying && commit());
+}
+
+void CredentialStore::put(uint64_t facilityCode, uint64_t cardNumber, const char *name, uint8_t flags)
+{
+  int32_t slot = index.find(facilityCode, cardNumber, pending);
+  if (slot < 0)
+  {
+    slot = pendingUsed++;
+    index.insert(facilityCode, cardNumber, slot);
+  }
+
+  Credential &credential = pending[slot];
+  credential.facilityCode = facilityCode;
+  credential.cardNumber = cardNumber;
+  strncpy(credential.name, name, sizeof(credential.name) - 1);
+  credential.name[sizeof(credential.name) - 1] = '\0';
+  credential.flags = flags;
+}
+
+bool CredentialStore::publishDue() const
+{
+  return unpublished;
+}
+
+bool CredentialStore::republish()
+{
+  return !unpublished || publish();
+}
+
+bool CredentialStore::commit()
+{
+  // the table still in use may hold the generation this merge would replace
+  if (!republish())
+  {
+    return false;
+  }
+  if (pendingUsed == 0)
+  {
+    return true;
+  }
+
+  // the merge needs the changes in key order, the index is rebuilt after
+  std::sort(pending, pending + pendingUsed, credentialLess);
+  bool ok = db.merge(pending, pendingUsed);
+
+  index.clear();
+  if (ok)
+  {
+    pendingUsed = 0;
+    total = db.count();
+    publish();
+    // everything logged is in the snapshot now
+    if (!replaying)
+    {
+      resetJournal();
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < pendingUsed; i++)
+    {
+      index.insert(pending[i].facilityCode, pending[i].cardNumber, i);
+    }
+  }
+  return ok;
+}
+
+bool CredentialStore::compactionDue() const
+{
+  return pendingUsed >= CREDENTIAL_COMPACT_THRESHOLD;
+}
+
+bool CredentialStore::pendingFull() const
+{
+  return pendingUsed >= MAX_PENDING_CREDENTIALS;
+}
+
+// sorted runs of the run file and the sorted pending changes merged into one
+// key order; on equal keys the pending change wins over the runs and an
+// earlier run over a later one, the others count as duplicates. A pending
+// delete is older than the import, batchAdd() only took the key because it
+// was deleted, so the first run holding the key wins over it.
+class BatchRunMerge : public CredentialSource
+{
+public:
+  BatchRunMerge(File &in, const size_t *runStarts, size_t runCount, const Credential *pending, size_t pendingCount)
+      : in(in), runStarts(runStarts), runCount(runCount), pending(pending), pendingCount(pendingCount)
+  {
+  }
+
+  ~BatchRunMerge()
+  {
+    delete[] buffers;
+    delete[] positions;
+    delete[] buffered;
+    delete[] used;
+  }
+
+  bool begin()
+  {
+    buffers = new (std::nothrow) Credential[runCount * CREDENTIAL_RUN_BUFFER];
+    positions = new (std::nothrow) size_t[runCount];
+    buffered = new (std::nothrow) size_t[runCount];
+    used = new (std::nothrow) size_t[runCount];
+    if (runCount > 0 && (buffers == nullptr || positions == nullptr || buffered == nullptr || used == nullptr))
+    {
+      return false;
+    }
+    for (size_t r = 0; r < runCount; r++)
+    {
+      positions[r] = runStarts[r];
+      buffered[r] = 0;
+      used[r] = 0;
+      if (!refill(r))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool next(Credential &credential) override
+  {
+    // input 0 is the pending changes, run r is input r + 1
+    const Credential *smallest = nullptr;
+    size_t winner = 0;
+    for (size_t input = 0; input <= runCount; input++)
+    {
+      const Credential *head = peek(input);
+      if (head != nullptr && (smallest == nullptr || credentialLess(*head, *smallest)))
+      {
+        smallest = head;
+        winner = input;
+      }
+    }
+    if (smallest == nullptr)
+    {
+      return false;
+    }
+    credential = *smallest;
+    advance(winner);
+
+    bool deleted = winner == 0 && (credential.flags & CREDENTIAL_DELETED);
+    for (size_t input = winner + 1; input <= runCount; input++)
+    {
+      const Credential *head = peek(input);
+      if (head != nullptr && !credentialLess(credential, *head))
+      {
+        if (deleted)
+        {
+          credential = *head;
+          deleted = false;
+        }
+        else
+        {
+          duplicates++;
+        }
+        advance(input);
+      }
+    }
+    return !readFailed;
+  }
+
+  bool failed() const override
+  {
+    return readFailed;
+  }
+
+  size_t duplicates = 0;
+
+private:
+  const Credential *peek(size_t input) const
+  {
+    if (input == 0)
+    {
+      return pendingUsed < pendingCount ? &pending[pendingUsed] : nullptr;
+    }
+    size_t r = input - 1;
+    return used[r] < buffered[r] ? &buffers[r * CREDENTIAL_RUN_BUFFER + used[r]] : nullptr;
+  }
+
+  void advance(size_t input)
+  {
+    if (input == 0)
+    {
+      pendingUsed++;
+      return;
+    }
+    size_t r = input - 1;
+    if (++used[r] >= buffered[r] && !refill(r))
+    {
+      readFailed = true;
+    }
+  }
+
+  // reads the next records of run r, none once it is used up
+  bool refill(size_t r)
+  {
+    size_t left = runStarts[r + 1] - positions[r];
+    size_t count = left < CREDENTIAL_RUN_BUFFER ? left : CREDENTIAL_RUN_BUFFER;
+    used[r] = 0;
+    buffered[r] = count;
+    if (count == 0)
+    {
+      return true;
+    }
+    size_t bytes = count * sizeof(Credential);
+    positions[r] += count;
+    return in.seek((positions[r] - count) * sizeof(Credential)) &&
+           in.read((uint8_t *)&buffers[r * CREDENTIAL_RUN_BUFFER], bytes) == bytes;
+  }
+
+  File &in;
+  const size_t *runStarts;
+  size_t runCount;
+  const Credential *pending;
+  size_t pendingCount;
+  size_t pendingUsed = 0;
+  Credential *buffers = nullptr;
+  size_t *positions = nullptr;
+  size_t *buffered = nullptr;
+  size_t *used = nullptr;
+  bool readFailed = false;
+};
+
+String CredentialStore::runPath() const
+{
+  return String(journalPath) + ".run";
+}
+
+bool CredentialStore::beginBatch()
+{
+  if (batch != nullptr)
+  {
+    return false;
+  }
+  batch = new (std::nothrow) Credential[CREDENTIAL_BATCH_SIZE];
+  if (batch == nullptr)
+  {
+    return false;
+  }
+  run = fs->open(runPath(), "w");
+  if (!run)
+  {
+    abortBatch();
+    return false;
+  }
+  batchUsed = 0;
+  duplicates = 0;
+  runCount = 0;
+  runStarts[0] = 0;
+  return true;
+}
+
+BatchResult CredentialStore::batchAdd(uint64_t facilityCode, uint64_t cardNumber, const char *name)
+{
+  Credential existing;
+  if (batch == nullptr)
+  {
+    return BATCH_FAILED;
+  }
+  if (find(facilityCode, cardNumber, existing))
+  {
+    return BATCH_DUPLICATE;
+  }
+  if (batchUsed >= CREDENTIAL_BATCH_SIZE && !spillBatch())
+  {
+    return BATCH_FAILED;
+  }
+
+  Credential &credential = batch[batchUsed++];
+  credential.facilityCode = facilityCode;
+  credential.cardNumber = cardNumber;
+  strncpy(credential.name, name, sizeof(credential.name) - 1);
+  credential.name[sizeof(credential.name) - 1] = '\0';
+  credential.flags = 0;
+  return BATCH_ADDED;
+}
+
+// Sorts the credentials collected in RAM and appends them to the run file as
+// one run, costs the write of the batch and not of the database
+bool CredentialStore::spillBatch()
+{
+  if (batchUsed == 0)
+  {
+    return true;
+  }
+  if (runCount >= CREDENTIAL_MAX_RUNS)
+  {
+    return false;
+  }
+
+  // sort for the merge and drop keys given twice, the first one wins
+  std::stable_sort(batch, batch + batchUsed, credentialLess);
+  size_t unique = 1;
+  for (size_t i = 1; i < batchUsed; i++)
+  {
+    if (credentialLess(batch[unique - 1], batch[i]))
+    {
+      batch[unique++] = batch[i];
+    }
+  }
+
+  size_t bytes = unique * sizeof(Credential);
+  if (run.write((const uint8_t *)batch, bytes) != bytes)
+  {
+    return false;
+  }
+  duplicates += batchUsed - unique;
+  runStarts[runCount + 1] = runStarts[runCount] + unique;
+  runCount++;
+  batchUsed = 0;
+  return true;
+}
+
+bool CredentialStore::endBatch()
+{
+  if (batch == nullptr || !republish() || !spillBatch())
+  {
+    abortBatch();
+    return false;
+  }
+  run.close();
+  run = fs->open(runPath(), "r");
+
+  // the pending changes go into the same rewrite, like commit()
+  std::sort(pending, pending + pendingUsed, credentialLess);
+  BatchRunMerge merged(run, runStarts, runCount, pending, pendingUsed);
+  bool ok = run && merged.begin() && db.merge(merged);
+  duplicates += merged.duplicates;
+  abortBatch();
+
+  index.clear();
+  if (!ok)
+  {
+    for (size_t i = 0; i < pendingUsed; i++)
+    {
+      index.insert(pending[i].facilityCode, pending[i].cardNumber, i);
+    }
+    return false;
+  }
+  pendingUsed = 0;
+  total = db.count();
+  publish();
+  resetJournal();
+  return true;
+}
+
+void CredentialStore::abortBatch()
+{
+  delete[] batch;
+  batch = nullptr;
+  batchUsed = 0;
+  runCount = 0;
+  if (run)
+  {
+    run.close();
+  }
+  if (fs != nullptr && fs->exists(runPath()))
+  {
+    fs->remove(runPath());
+  }
+}
+
+bool CredentialStore::batchOpen() const
+{
+  return batch != nullptr;
+}
+
+size_t CredentialStore::batchDuplicates() const
+{
+  return duplicates;
+}
+
+size_t CredentialStore::list(const Credential *after, Credential *credentials, size_t count)
+{
+  bool haveKey = after != nullptr;
+  uint64_t facilityCode = haveKey ? after->facilityCode : 0;
+  uint64_t cardNumber = haveKey ? after->cardNumber : 0;
+  size_t i = haveKey ? db.lowerBound(facilityCode, cardNumber) : 0;
+  Credential stored;
+  bool haveStored = false;
+
+  size_t n = 0;
+  while (n < count)
+  {
+    // next stored credential above the key that no pending change shadows
+    while (!haveStored && i < db.count())
+    {
+      if (!db.read(i++, stored))
+      {
+        i = db.count();
+        break;
+      }
+      haveStored = (!haveKey || credentialKeyLess(facilityCode, cardNumber, stored.facilityCode, stored.cardNumber)) &&
+                   index.find(stored.facilityCode, stored.cardNumber, pending) < 0;
+    }
+
+    // the pending changes are not sorted, take the smallest key above it
+    const Credential *next = haveStored ? &stored : nullptr;
+    for (size_t j = 0; j < pendingUsed; j++)
+    {
+      const Credential &candidate = pending[j];
+      if (!(candidate.flags & CREDENTIAL_DELETED) &&
+          (!haveKey || credentialKeyLess(facilityCode, cardNumber, candidate.facilityCode, candidate.cardNumber)) &&
+          (next == nullptr || credentialLess(candidate, *next)))
+      {
+        next = &candidate;
+      }
+    }
+    if (next == nullptr)
+    {
+      break;
+    }
+
+    credentials[n++] = *next;
+    facilityCode = next->facilityCode;
+    cardNumber = next->cardNumber;
+    haveKey = true;
+    if (next == &stored)
+    {
+      haveStored = false;
+    }
+  }
+  return n;
+}
+
+size_t CredentialStore::count() const
+{
+  return total;
+}
+
+size_t CredentialStore::pendingCount() const
+{
+  return pendingUsed;
+}
+
+size_t CredentialStore::memoryUsage() const
+{
+  CredentialTable *current = table.load();
+  return db.memoryUsage() + sizeof(pending) + (current != nullptr ? current->memoryUsage() : 0);
+}
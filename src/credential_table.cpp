@@ -0,0 +1,58 @@
+#include "credential_table.h"
+
+#include <new>
+
+CredentialTable::~CredentialTable()
+{
+  if (file)
+  {
+    file.close();
+  }
+  delete[] changes;
+}
+
+bool CredentialTable::begin(fs::FS &fs, const CredentialImage &image, const Credential *changes, size_t changeCount)
+{
+  this->image = &image;
+  file = fs.open(image.path(), "r");
+  if (!file || !index.begin(changeCount))
+  {
+    return false;
+  }
+  if (changeCount > 0)
+  {
+    this->changes = new (std::nothrow) Credential[changeCount];
+    if (this->changes == nullptr)
+    {
+      return false;
+    }
+    memcpy(this->changes, changes, changeCount * sizeof(Credential));
+  }
+  this->changeCount = changeCount;
+  for (size_t i = 0; i < changeCount; i++)
+  {
+    index.insert(changes[i].facilityCode, changes[i].cardNumber, i);
+  }
+  return true;
+}
+
+bool CredentialTable::find(uint64_t facilityCode, uint64_t cardNumber, Credential &credential)
+{
+  // a pending change shadows the database, a deletion hides the key
+  int32_t slot = index.find(facilityCode, cardNumber, changes);
+  if (slot >= 0)
+  {
+    if (changes[slot].flags & CREDENTIAL_DELETED)
+    {
+      return false;
+    }
+    credential = changes[slot];
+    return true;
+  }
+  return image->find(file, facilityCode, cardNumber, credential);
+}
+
+size_t CredentialTable::memoryUsage() const
+{
+  return changeCount * sizeof(Credential);
+}
@@ -0,0 +1,292 @@
+#ifndef ARDUINO
+
+#include "hal_native.h"
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the clocks start with the program, like they start at boot on the device
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long millis()
+{
+  return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros()
+{
+  // wraps like the 32 bit counter of the device
+  return (uint32_t)esp_timer_get_time();
+}
+
+uint32_t esp_random()
+{
+  static std::mt19937 generator(std::random_device{}());
+  return generator();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+String::String(const char *text) : text(text != nullptr ? text : "")
+{
+}
+
+String::String(char c) : text(1, c)
+{
+}
+
+String::String(int value) : text(std::to_string(value))
+{
+}
+
+String::String(unsigned int value) : text(std::to_string(value))
+{
+}
+
+String::String(long value) : text(std::to_string(value))
+{
+}
+
+String::String(unsigned long value) : text(std::to_string(value))
+{
+}
+
+String::String(long long value) : text(std::to_string(value))
+{
+}
+
+String::String(unsigned long long value) : text(std::to_string(value))
+{
+}
+
+size_t String::length() const
+{
+  return text.size();
+}
+
+const char *String::c_str() const
+{
+  return text.c_str();
+}
+
+bool String::reserve(size_t size)
+{
+  text.reserve(size);
+  return true;
+}
+
+bool String::concat(const char *other)
+{
+  text += other;
+  return true;
+}
+
+size_t String::write(uint8_t c)
+{
+  text += (char)c;
+  return 1;
+}
+
+size_t String::write(const uint8_t *data, size_t size)
+{
+  text.append((const char *)data, size);
+  return size;
+}
+
+char String::operator[](size_t index) const
+{
+  return index < text.size() ? text[index] : '\0';
+}
+
+String &String::operator+=(const String &other)
+{
+  text += other.text;
+  return *this;
+}
+
+String &String::operator+=(const char *other)
+{
+  text += other;
+  return *this;
+}
+
+String &String::operator+=(char c)
+{
+  text += c;
+  return *this;
+}
+
+bool String::operator==(const String &other) const
+{
+  return text == other.text;
+}
+
+bool String::operator==(const char *other) const
+{
+  return text == other;
+}
+
+bool String::operator!=(const String &other) const
+{
+  return text != other.text;
+}
+
+String operator+(const String &left, const String &right)
+{
+  String result = left;
+  result += right;
+  return result;
+}
+
+String operator+(const String &left, const char *right)
+{
+  String result = left;
+  result += right;
+  return result;
+}
+
+String operator+(const char *left, const String &right)
+{
+  String result = left;
+  result += right;
+  return result;
+}
+
+namespace fs
+{
+
+File::File(FILE *handle) : handle(handle, fclose)
+{
+}
+
+File::operator bool() const
+{
+  return (bool)handle;
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+  return handle ? fread(buffer, 1, size, handle.get()) : 0;
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::available()
+{
+  return handle ? (int)(size() - position()) : 0;
+}
+
+size_t File::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *data, size_t size)
+{
+  return handle ? fwrite(data, 1, size, handle.get()) : 0;
+}
+
+bool File::seek(uint32_t position, SeekMode mode)
+{
+  static const int origins[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+  return handle && fseek(handle.get(), position, origins[mode]) == 0;
+}
+
+size_t File::position() const
+{
+  return handle ? ftell(handle.get()) : 0;
+}
+
+size_t File::size() const
+{
+  struct stat info;
+  if (!handle || fflush(handle.get()) != 0 || fstat(fileno(handle.get()), &info) != 0)
+  {
+    return 0;
+  }
+  return info.st_size;
+}
+
+void File::flush()
+{
+  if (handle)
+  {
+    fflush(handle.get());
+  }
+}
+
+void File::close()
+{
+  handle.reset();
+}
+
+FS::FS(const char *root) : root(root)
+{
+}
+
+std::string FS::hostPath(const char *path) const
+{
+  return root + path;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+  // binary, and "a" can be read back like on LittleFS
+  std::string hostMode = mode[0] == 'a' ? "a+b" : std::string(mode) + "b";
+  FILE *handle = fopen(hostPath(path).c_str(), hostMode.c_str());
+  return handle != nullptr ? File(handle) : File();
+}
+
+File FS::open(const String &path, const char *mode)
+{
+  return open(path.c_str(), mode);
+}
+
+bool FS::exists(const char *path)
+{
+  return access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+bool FS::exists(const String &path)
+{
+  return exists(path.c_str());
+}
+
+bool FS::remove(const char *path)
+{
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::remove(const String &path)
+{
+  return remove(path.c_str());
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::rename(const String &from, const String &to)
+{
+  return rename(from.c_str(), to.c_str());
+}
+
+} // namespace fs
+
+#endif // ARDUINO
@@ -0,0 +1,97 @@
+#include "json_stream.h"
+
+JsonArrayStream::JsonArrayStream(JsonElementSource source) : source(source)
+{
+}
+
+void JsonArrayStream::refill()
+{
+  pending = elements == 0 ? "[" : "";
+  sent = 0;
+
+  JsonDocument element;
+  if (!source(element))
+  {
+    pending += "]";
+    finished = true;
+    return;
+  }
+  if (elements++ > 0)
+  {
+    pending += ",";
+  }
+  String json;
+  serializeJson(element, json);
+  pending += json;
+}
+
+size_t JsonArrayStream::fill(uint8_t *buffer, size_t maxLen)
+{
+  size_t n = 0;
+  while (n < maxLen)
+  {
+    if (sent >= pending.length())
+    {
+      if (finished)
+      {
+        break;
+      }
+      refill();
+    }
+    size_t length = min(pending.length() - sent, maxLen - n);
+    memcpy(buffer + n, pending.c_str() + sent, length);
+    sent += length;
+    n += length;
+  }
+  return n;
+}
+
+void JsonObjectStream::add(const char *name, JsonElementSource source)
+{
+  members.push_back({name, JsonArrayStream(source)});
+}
+
+size_t JsonObjectStream::fill(uint8_t *buffer, size_t maxLen)
+{
+  size_t n = 0;
+  while (n < maxLen)
+  {
+    if (sent < pending.length())
+    {
+      size_t length = min(pending.length() - sent, maxLen - n);
+      memcpy(buffer + n, pending.c_str() + sent, length);
+      sent += length;
+      n += length;
+      continue;
+    }
+    if (opened)
+    {
+      size_t length = members[current].array.fill(buffer + n, maxLen - n);
+      if (length > 0)
+      {
+        n += length;
+        continue;
+      }
+      // the array is closed, go on with the next member
+      opened = false;
+      current++;
+    }
+    if (finished)
+    {
+      break;
+    }
+
+    sent = 0;
+    if (current < members.size())
+    {
+      pending = String(current == 0 ? "{\"" : ",\"") + members[current].name + "\":";
+      opened = true;
+    }
+    else
+    {
+      pending = members.empty() ? "{}" : "}";
+      finished = true;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,90 @@
+#include "lcd_framebuffer.h"
+
+LcdFramebuffer::LcdFramebuffer(LiquidCrystal_I2C &device) : device(device)
+{
+  memset(cells, ' ', sizeof(cells));
+  memset(shown, ' ', sizeof(shown));
+}
+
+bool LcdFramebuffer::begin(int sda, int scl)
+{
+  device.init(sda, scl);
+  device.clear();
+  // the loop task runs on core 1, keep the I2C traffic on core 0
+  return xTaskCreatePinnedToCore(flushTask, "lcd", 2048, this, 1, nullptr, 0) == pdPASS;
+}
+
+void LcdFramebuffer::backlight()
+{
+  backlightPending = true;
+}
+
+void LcdFramebuffer::clear()
+{
+  memset(cells, ' ', sizeof(cells));
+  col = 0;
+  row = 0;
+  dirty = true;
+}
+
+void LcdFramebuffer::setCursor(uint8_t col, uint8_t row)
+{
+  this->col = col;
+  this->row = row;
+}
+
+size_t LcdFramebuffer::write(uint8_t c)
+{
+  if (row >= LCD_ROWS || col >= LCD_COLS)
+  {
+    return 0;
+  }
+  cells[row][col++] = c;
+  dirty = true;
+  return 1;
+}
+
+void LcdFramebuffer::flushTask(void *arg)
+{
+  LcdFramebuffer *lcd = (LcdFramebuffer *)arg;
+  for (;;)
+  {
+    if (lcd->backlightPending.exchange(false))
+    {
+      lcd->device.backlight();
+    }
+    // a write landing while the frame is sent marks it dirty again
+    if (lcd->dirty.exchange(false))
+    {
+      lcd->sendChanges();
+    }
+    vTaskDelay(pdMS_TO_TICKS(LCD_FLUSH_INTERVAL));
+  }
+}
+
+void LcdFramebuffer::sendChanges()
+{
+  char frame[LCD_ROWS][LCD_COLS];
+  memcpy(frame, cells, sizeof(frame));
+
+  for (uint8_t r = 0; r < LCD_ROWS; r++)
+  {
+    // the display moves its cursor after each character, only a gap of
+    // unchanged cells needs a new setCursor()
+    int cursor = -1;
+    for (uint8_t c = 0; c < LCD_COLS; c++)
+    {
+      if (frame[r][c] == shown[r][c])
+      {
+        continue;
+      }
+      if (cursor != c)
+      {
+        device.setCursor(c, r);
+      }
+      device.write(frame[r][c]);
+      shown[r][c] = frame[r][c];
+      cursor = c + 1;
+    }
+  }
+}
@@ -10,16 +10,48 @@
 #include <LittleFS.h>
 
 #include "doorsim.h"
+#include "wiegand.h"
+#include "wiegand_reader.h"
+#include "card_formats.h"
+#include "card_decoder.h"
+#include "credential_store.h"
+#include "credential_import.h"
+#include "output_pattern.h"
+#include "lcd_framebuffer.h"
+#include "spsc_queue.h"
+#include "card_history.h"
+#include "audit_log.h"
+#include "json_stream.h"
+#include "settings_snapshot.h"
+#include "esp_timer.h"
+#include <memory>
+#include <atomic>
 
 AsyncWebServer server(80);
+// reads and credential changes pushed to the dashboards as Server-Sent Events
+AsyncEventSource events("/events");
 
+// settings as loaded at boot, settings.json is their import and export
+const char *settingsSnapshotFile = "/settings.bin";
 const char *settingsFile = "/settings.json";
+// credentials of older firmware, imported once into the database
 const char *credentialsFile = "/credentials.json";
+const char *credentialsDbFile = "/credentials.db";
+// credential changes since the last compaction of credentialsDbFile
+const char *credentialsJournalFile = "/credentials.log";
+// every card read, segments are stored next to it as /audit.log.<n>
+const char *auditLogFile = "/audit.log";
+// web interface, index.html.gz is written by scripts/compress_web.py
+const char *indexFile = "/index.html";
+const char *indexGzFile = "/index.html.gz";
+bool indexGzipped = false;
 
 #define I2C_SDA 21
 #define I2C_SCL 22
 // Set the LCD I2C address
-LiquidCrystal_I2C lcd(0x20, 20, 4);
+LiquidCrystal_I2C lcdDisplay(0x20, LCD_COLS, LCD_ROWS);
+// screen contents are drawn in RAM and sent to lcdDisplay in the background
+LcdFramebuffer lcd(lcdDisplay);
 
 // general device settings
 bool isCapturing = true;
@@ -27,24 +59,61 @@ String MODE = "CTF";
 
 // card reader config and variables
 
-// max number of bits
-#define MAX_BITS 100
-// time to wait for another weigand pulse
-#define WEIGAND_WAIT_TIME 3000
-
-// stores all of the data bits
-volatile unsigned char databits[MAX_BITS];
-volatile unsigned int bitCount = 0;
-
-// stores the last written card's data bits
-unsigned char lastWrittenDatabits[MAX_BITS];
-unsigned int lastWrittenBitCount = 0;
-
-// goes low when data is currently being captured
-volatile unsigned char flagDone;
-
-// countdown until we assume there are no more bits
-volatile unsigned int weigandCounter;
+// default silence on the data lines that ends a frame, in microseconds, and
+// the range the settings page allows
+#define WIEGAND_FRAME_GAP 5000
+#define MIN_FRAME_GAP 1000
+#define MAX_FRAME_GAP 100000
+
+// readers connected, build with -D READER_COUNT=n for more than one
+#ifndef READER_COUNT
+#define READER_COUNT 1
+#endif
+#define MAX_READERS 4
+static_assert(READER_COUNT >= 1 && READER_COUNT <= MAX_READERS, "READER_COUNT must be 1 to MAX_READERS");
+
+// Card pipeline: capture and decision tasks run on core 1, away from WiFi,
+// the web server, the LCD and flash writes, which the effects, storage and
+// AsyncTCP tasks handle on core 0
+#define FRAME_QUEUE_SIZE 8
+#define DECISION_QUEUE_SIZE 16
+// frames waiting for a decision
+SpscQueue<CardEvent, FRAME_QUEUE_SIZE> frameQueue;
+// decisions waiting for the LCD, feedback and history
+SpscQueue<CardEvent, DECISION_QUEUE_SIZE> decisionQueue;
+TaskHandle_t decisionTaskHandle = nullptr;
+TaskHandle_t effectsTaskHandle = nullptr;
+// Flash writes: credential compaction, imports and the audit log, on a task
+// below the effects task so they never delay the outputs
+#define AUDIT_QUEUE_SIZE 32
+// reads to append to the audit log, from the effects task
+SpscQueue<CardRecord, AUDIT_QUEUE_SIZE> auditQueue;
+TaskHandle_t storageTaskHandle = nullptr;
+// the storage task checks the idle conditions at least this often, in ms
+#define STORAGE_POLL_TIME 100
+// Events for the dashboards, sent by the events task. Sending can wait on a
+// slow client, a full queue drops the event instead of holding up the
+// effects task or the web server.
+#define LIVE_CARD_QUEUE_SIZE 16
+#define LIVE_CREDENTIAL_QUEUE_SIZE 8
+// reads, from the effects task
+SpscQueue<LiveEvent, LIVE_CARD_QUEUE_SIZE> liveCardEvents;
+// credential changes, from the web handlers
+SpscQueue<LiveEvent, LIVE_CREDENTIAL_QUEUE_SIZE> liveCredentialEvents;
+TaskHandle_t eventsTaskHandle = nullptr;
+// A dropped credential change would leave the user tables stale until the
+// next change, so the events task follows up with a "refresh" event
+std::atomic<bool> credentialRefreshPending{false};
+uint32_t lastDroppedFrames = 0;
+uint32_t lastDroppedDecisions = 0;
+uint32_t lastDroppedCardEvents = 0;
+uint32_t lastDroppedCredentialEvents = 0;
+uint32_t lastDroppedAuditRecords = 0;
+// slowest decision seen so far, in microseconds
+uint32_t maxDecisionLatency = 0;
+
+// silence after the last edge before the frame is complete, in microseconds
+unsigned long frameGap = WIEGAND_FRAME_GAP;
 
 // Display screen timer
 unsigned long displayTimeout = 30000; // 30 seconds
@@ -70,29 +139,49 @@ int ledValid = 1;
 String customMessage;
 String welcomeMessage = "default";
 
+// format of the last decoded card, nullptr when not supported
+const CardFormat *cardFormat = nullptr;
+// whether the last decoded card passed the parity checks of its format
+bool parityValid = false;
+
 // decoded facility code and card code
-unsigned long facilityCode = 0;
-unsigned long cardNumber = 0;
+uint64_t facilityCode = 0;
+uint64_t cardNumber = 0;
 
 // hex data string
 String hexCardData;
 
 // raw data string
 String rawCardData;
-String status;
-String details;
-
-// breaking up card value into 2 chunks to create 10 char HEX value
-volatile unsigned long bitHolder1 = 0;
-volatile unsigned long bitHolder2 = 0;
-unsigned long cardChunk1 = 0;
-unsigned long cardChunk2 = 0;
 
-// Define reader input pins
-// card reader DATA0
-#define DATA0 19
-// card reader DATA1
-#define DATA1 18
+// Define reader input pins, DATA0 then DATA1 of every reader. Only the
+// first READER_COUNT are built, each holds an edge ring of its own.
+WiegandReader<19, 18> reader1(1);
+#if READER_COUNT >= 2
+WiegandReader<27, 14> reader2(2);
+#endif
+#if READER_COUNT >= 3
+WiegandReader<16, 17> reader3(3);
+#endif
+#if READER_COUNT >= 4
+WiegandReader<13, 4> reader4(4);
+#endif
+// Each reader has its own edge ring and frame, filled by its own ISRs and
+// assembled by the capture task
+ReaderChannel *const readers[READER_COUNT] = {
+    &reader1,
+#if READER_COUNT >= 2
+    &reader2,
+#endif
+#if READER_COUNT >= 3
+    &reader3,
+#endif
+#if READER_COUNT >= 4
+    &reader4,
+#endif
+};
+// edges dropped by each reader as last reported
+uint32_t lastDroppedEdges[READER_COUNT] = {};
 
 // define reader output pins
 //  LED Output for a GND tie back
@@ -104,72 +193,207 @@ unsigned long cardChunk2 = 0;
 #define RELAY1 25
 #define RELAY2 26
 
-const int MAX_CREDENTIALS = 100;
-Credential credentials[MAX_CREDENTIALS];
-int validCount = 0;
-
-// maximum number of stored cards
-const int MAX_CARDS = 100;
-CardData cardDataArray[MAX_CARDS];
-int cardDataIndex = 0;
-
-// Interrupts for card reader
-void ISR_INT0()
+// time the door strike on RELAY1 stays released for a valid credential
+#define DOOR_STRIKE_TIME 3000
+
+// feedback outputs, played by the effects task so they never hold up card reads
+OutputChannel ledOutput;
+OutputChannel speakerOutput;
+OutputChannel relay1Output;
+OutputChannel relay2Output;
+
+// Flashing LED
+const PatternStep ledFlashSteps[] = {{true, 250}, {false, 100}, {true, 250}};
+const OutputPattern ledFlash = {ledFlashSteps, 3};
+const PatternStep ledLongSteps[] = {{true, 2000}};
+const OutputPattern ledLong = {ledLongSteps, 1};
+// Nice Beeps
+const PatternStep niceBeepSteps[] = {{true, 100}, {false, 50}, {true, 100}};
+const OutputPattern niceBeeps = {niceBeepSteps, 3};
+// Long Beeps
+const PatternStep longBeepSteps[] = {{true, 2000}};
+const OutputPattern longBeep = {longBeepSteps, 1};
+// Sad Beeps
+const PatternStep sadBeepSteps[] = {{true, 100}, {false, 50}, {true, 100}, {false, 50}, {true, 100}, {false, 50}, {true, 100}};
+const OutputPattern sadBeeps = {sadBeepSteps, 7};
+// door strike released for DOOR_STRIKE_TIME
+const PatternStep doorStrikeSteps[] = {{true, DOOR_STRIKE_TIME}};
+const OutputPattern doorStrike = {doorStrikeSteps, 1};
+
+// sorted credentials database on flash plus the changes not merged yet
+CredentialStore credentialStore;
+// time without card reads before pending credential changes are compacted
+#define COMPACT_IDLE_TIME 10000
+// serializes the writers of the credential store: the web handlers and the
+// compaction, the decision task reads it without locking
+SemaphoreHandle_t credentialLock = nullptr;
+// the web handlers wait this long for the credential lock, a compaction holds
+// it for a whole database rewrite and they must not stall the web server
+#define CREDENTIAL_LOCK_WAIT 50
+// bulk import running on /importCredentials, one request at a time; the web
+// server parses the body, the storage task merges it
+CredentialImporter credentialImporter;
+AsyncWebServerRequest *importRequest = nullptr;
+std::atomic<ImportState> importState{IMPORT_IDLE};
+// an import request turned away when its body started, answered once it ends
+AsyncWebServerRequest *refusedImport = nullptr;
+int refusedImportStatus = 0;
+const char *refusedImportReason = "";
+// a merged import for the events task to announce
+std::atomic<bool> importEventPending{false};
+
+// latest card reads, written by the effects task and read by the web server
+CardHistory cardHistory;
+// durable copy of the history, appended by the storage task and queried by
+// the web server under auditLock
+AuditLog auditLog;
+SemaphoreHandle_t auditLock = nullptr;
+// time without card reads before the buffered audit records are written
+#define AUDIT_IDLE_TIME 1000
+// reads printed to Serial after every card
+#define SERIAL_HISTORY_LINES 100
+// Serial output queued before it blocks the writer
+#define SERIAL_TX_BUFFER_SIZE 1024
+// history sequences restart on every boot, clients tell boots apart by it
+uint32_t bootId = 0;
+
+// A gap of 0 would end a frame at every edge and one above INT32_MAX would
+// never end it, whatever a client or a settings file holds
+unsigned long clampFrameGap(int64_t gap)
 {
-  bitCount++;
-  flagDone = 0;
-
-  if (bitCount < 23)
+  if (gap < MIN_FRAME_GAP)
   {
-    bitHolder1 = bitHolder1 << 1;
+    return MIN_FRAME_GAP;
   }
-  else
+  return gap > MAX_FRAME_GAP ? MAX_FRAME_GAP : gap;
+}
+
+// drain the edges recorded by the ISRs of a reader into its frame, true once
+// its data lines have been quiet for frameGap
+bool readWiegandEdges(ReaderChannel &reader)
+{
+  return reader.poll(micros(), frameGap);
+}
+
+// true while no reader has edges waiting
+bool readersIdle()
+{
+  for (unsigned int i = 0; i < READER_COUNT; i++)
   {
-    bitHolder2 = bitHolder2 << 1;
+    if (!readers[i]->isIdle())
+    {
+      return false;
+    }
   }
-  // Reset the wait timer
-  weigandCounter = WEIGAND_WAIT_TIME;
+  return true;
 }
 
-// interrupt that happens when INT1 goes low (1 bit)
-void ISR_INT1()
+// report the edges and frames the pipeline had to drop, called by the
+// effects task so the capture path never writes to Serial
+void reportDroppedEdges()
 {
-  if (bitCount < MAX_BITS)
+  uint32_t dropped;
+  for (unsigned int i = 0; i < READER_COUNT; i++)
   {
-    databits[bitCount] = 1;
-    bitCount++;
+    dropped = readers[i]->droppedEdges();
+    if (dropped != lastDroppedEdges[i])
+    {
+      Serial.print("[-] Edge ring overflow on reader ");
+      Serial.print(readers[i]->id());
+      Serial.print(", dropped edges: ");
+      Serial.println(dropped);
+      lastDroppedEdges[i] = dropped;
+    }
   }
-  flagDone = 0;
-
-  if (bitCount < 23)
+  dropped = frameQueue.droppedItems();
+  if (dropped != lastDroppedFrames)
   {
-    bitHolder1 = bitHolder1 << 1;
-    bitHolder1 |= 1;
+    Serial.print("[-] Frame queue overflow, dropped frames: ");
+    Serial.println(dropped);
+    lastDroppedFrames = dropped;
   }
-  else
+  dropped = decisionQueue.droppedItems();
+  if (dropped != lastDroppedDecisions)
+  {
+    Serial.print("[-] Decision queue overflow, dropped reads: ");
+    Serial.println(dropped);
+    lastDroppedDecisions = dropped;
+  }
+  // dashboards notice a missed read by its sequence and fetch it
+  dropped = liveCardEvents.droppedItems();
+  if (dropped != lastDroppedCardEvents)
+  {
+    Serial.print("[-] Live card event queue overflow, dropped events: ");
+    Serial.println(dropped);
+    lastDroppedCardEvents = dropped;
+  }
+  dropped = liveCredentialEvents.droppedItems();
+  if (dropped != lastDroppedCredentialEvents)
   {
-    bitHolder2 = bitHolder2 << 1;
-    bitHolder2 |= 1;
+    Serial.print("[-] Live credential event queue overflow, dropped events: ");
+    Serial.println(dropped);
+    lastDroppedCredentialEvents = dropped;
+  }
+  dropped = auditQueue.droppedItems();
+  if (dropped != lastDroppedAuditRecords)
+  {
+    Serial.print("[-] Audit queue overflow, dropped records: ");
+    Serial.println(dropped);
+    lastDroppedAuditRecords = dropped;
   }
-  // Reset the wait timer
-  weigandCounter = WEIGAND_WAIT_TIME;
 }
 
-void saveSettingsToPreferences()
+// the settings globals as the boot snapshot holds them
+void settingsToSnapshot(SettingsSnapshot &settings)
 {
-  Serial.println("Saving settings to Preferences...");
+  settings = {};
+  setSnapshotText(settings.mode, sizeof(settings.mode), MODE.c_str());
+  settings.displayTimeout = displayTimeout;
+  settings.frameGap = frameGap;
+  settings.apMode = ap_mode;
+  setSnapshotText(settings.apSsid, sizeof(settings.apSsid), ap_ssid.c_str());
+  setSnapshotText(settings.apPassphrase, sizeof(settings.apPassphrase), ap_passphrase.c_str());
+  settings.apChannel = ap_channel;
+  settings.ssidHidden = ssid_hidden;
+  settings.spkOnInvalid = spkOnInvalid;
+  settings.spkOnValid = spkOnValid;
+  settings.ledValid = ledValid;
+  setSnapshotText(settings.customMessage, sizeof(settings.customMessage), customMessage.c_str());
+  setSnapshotText(settings.welcomeMessage, sizeof(settings.welcomeMessage), welcomeMessage.c_str());
+}
+
+void settingsFromSnapshot(const SettingsSnapshot &settings)
+{
+  MODE = settings.mode;
+  displayTimeout = settings.displayTimeout;
+  frameGap = clampFrameGap(settings.frameGap);
+  ap_mode = settings.apMode;
+  ap_ssid = settings.apSsid;
+  ap_passphrase = settings.apPassphrase;
+  ap_channel = settings.apChannel;
+  ssid_hidden = settings.ssidHidden;
+  spkOnInvalid = settings.spkOnInvalid;
+  spkOnValid = settings.spkOnValid;
+  ledValid = settings.ledValid;
+  customMessage = settings.customMessage;
+  welcomeMessage = settings.welcomeMessage;
+}
 
+// settings.json is the export of the settings, kept up to date so a firmware
+// with a new snapshot version imports the current ones
+bool exportSettingsJson()
+{
   File file = LittleFS.open(settingsFile, "w");
   if (!file)
   {
-    Serial.println("Failed to open settings file for writing.");
-    return;
+    return false;
   }
 
   // Write settings to JSON
   JsonDocument doc;
   doc["MODE"] = MODE;
   doc["displayTimeout"] = displayTimeout;
+  doc["frameGap"] = frameGap;
   doc["ap_mode"] = ap_mode;
   doc["ap_ssid"] = ap_ssid;
   doc["ap_passphrase"] = ap_passphrase;
@@ -181,57 +405,36 @@ void saveSettingsToPreferences()
   doc["customMessage"] = customMessage;
   doc["welcomeMessage"] = welcomeMessage;
 
-  if (serializeJson(doc, file) == 0)
-  {
-    Serial.println("Failed to write settings to file.");
-  }
-  else
-  {
-    Serial.println("customMessage: " + customMessage);
-    Serial.println("Settings saved successfully.");
-  }
+  bool ok = serializeJson(doc, file) > 0;
   file.close();
-  Serial.println("Settings saved!");
+  return ok;
 }
 
-void loadSettingsFromPreferences()
+bool importSettingsJson()
 {
-  if (!LittleFS.exists(settingsFile))
-  {
-    Serial.println("Settings file does not exist. Creating with defaults...");
-    saveSettingsToPreferences();
-    return;
-  }
-
   File file = LittleFS.open(settingsFile, "r");
   if (!file)
   {
     Serial.println("Failed to open settings file for reading.");
-    return;
+    return false;
   }
 
   // Parse JSON from file
   JsonDocument doc;
   DeserializationError error = deserializeJson(doc, file);
-  Serial.println("File Content:");
-  file.seek(0);
-  while (file.available())
-  {
-    Serial.write(file.read());
-  }
   file.close();
-  Serial.println();
 
   if (error)
   {
     Serial.print("Failed to parse settings file: ");
     Serial.println(error.c_str());
-    return;
+    return false;
   }
 
   // Load settings
   MODE = doc["MODE"] | "CTF";
   displayTimeout = doc["displayTimeout"] | 30000;
+  frameGap = clampFrameGap(doc["frameGap"] | (int64_t)WIEGAND_FRAME_GAP);
   ap_mode = doc["ap_mode"] | true;
   ap_ssid = doc["ap_ssid"] | "doorsim";
   ap_passphrase = doc["ap_passphrase"] | "";
@@ -245,66 +448,69 @@ void loadSettingsFromPreferences()
   {
     customMessage = doc["customMessage"] | "";
   }
-  Serial.println("Settings loaded successfully:");
+  return true;
 }
 
-void saveCredentialsToPreferences()
+void saveSettingsToPreferences()
 {
-  File file = LittleFS.open(credentialsFile, "w");
-  if (!file)
+  SettingsSnapshot settings;
+  settingsToSnapshot(settings);
+  if (!writeSettingsSnapshot(LittleFS, settingsSnapshotFile, settings))
   {
-    Serial.println("Failed to open credentials file for writing.");
+    Serial.println("Failed to write settings snapshot.");
     return;
   }
-
-  // Write settings to JSON
-  JsonDocument doc;
-  doc["validCount"] = validCount;
-  JsonArray credentialsArray = doc.createNestedArray("credentials");
-  for (int i = 0; i < validCount; i++)
+  if (!exportSettingsJson())
   {
-    JsonObject credential = credentialsArray.createNestedObject();
-    credential["facilityCode"] = credentials[i].facilityCode;
-    credential["cardNumber"] = credentials[i].cardNumber;
-    credential["name"] = credentials[i].name;
+    Serial.println("Failed to write settings to file.");
   }
+  Serial.println("Settings saved!");
+}
 
-  if (serializeJson(doc, file) == 0)
+// Boots from the binary snapshot with one read. Without one, on first boot
+// or after the snapshot version changed, settings.json is imported, or the
+// defaults are used when there is none.
+void loadSettingsFromPreferences()
+{
+  SettingsSnapshot settings;
+  if (readSettingsSnapshot(LittleFS, settingsSnapshotFile, settings))
   {
-    Serial.println("Failed to write credentials to file.");
+    settingsFromSnapshot(settings);
+    Serial.println("Settings loaded.");
+    return;
   }
-  else
+
+  if (LittleFS.exists(settingsFile))
   {
-    Serial.println("credentials saved successfully.");
+    Serial.println("Importing settings.json...");
+    if (!importSettingsJson())
+    {
+      // kept for the next boot, the defaults are used until then
+      return;
+    }
   }
-  file.close();
-
-  for (int i = 0; i < validCount; i++)
+  else
   {
-    Serial.print("Credential ");
-    Serial.print(i);
-    Serial.print(": FC=");
-    Serial.print(credentials[i].facilityCode);
-    Serial.print(", CN=");
-    Serial.print(credentials[i].cardNumber);
-    Serial.print(", Name=");
-    Serial.println(credentials[i].name);
+    Serial.println("Settings file does not exist. Creating with defaults...");
   }
-  Serial.print("Valid Count: ");
-  Serial.println(validCount);
+  saveSettingsToPreferences();
 }
 
-void loadCredentialsFromPreferences()
+void saveCredentialsToPreferences()
 {
-  Serial.println("Loading credentials from Preferences...");
-
-  if (!LittleFS.exists(credentialsFile))
+  // compact the journaled changes into a new credentials database snapshot
+  if (!credentialStore.commit())
   {
-    Serial.println("credentials file does not exist. Creating with defaults...");
-    saveCredentialsToPreferences();
+    Serial.println("Failed to write credentials to flash.");
     return;
   }
+  Serial.print("Credentials saved, count: ");
+  Serial.println(credentialStore.count());
+}
 
+// import the credentials.json of older firmware into the database
+void migrateCredentialsFromJson()
+{
   File file = LittleFS.open(credentialsFile, "r");
   if (!file)
   {
@@ -315,71 +521,121 @@ void loadCredentialsFromPreferences()
   // Parse JSON from file
   JsonDocument doc;
   DeserializationError error = deserializeJson(doc, file);
-  Serial.println("File Content:");
-  file.seek(0);
-  while (file.available())
-  {
-    Serial.write(file.read());
-  }
   file.close();
-  Serial.println();
 
   if (error)
   {
-    Serial.print("Failed to parse settings file: ");
+    Serial.print("Failed to parse credentials file: ");
     Serial.println(error.c_str());
     return;
   }
 
-  // Load settings
-  validCount = doc["validCount"] | 0;
-  if (validCount > 0)
+  JsonArray credentialsArray = doc["credentials"].as<JsonArray>();
+  for (JsonObject credential : credentialsArray)
   {
-    JsonArray credentialsArray = doc["credentials"].as<JsonArray>();
-    for (int i = 0; i < validCount; i++)
+    uint64_t fc = credential["facilityCode"] | (uint64_t)0;
+    uint64_t cn = credential["cardNumber"] | (uint64_t)0;
+    const char *name = credential["name"] | "";
+    // at boot, nothing else waits for the compaction
+    if (credentialStore.pendingFull())
     {
-      Serial.println("Loading credential " + String(i));
-      JsonObject credential = credentialsArray[i].as<JsonObject>();
-      credentials[i].facilityCode = credential["facilityCode"] | 0;
-      credentials[i].cardNumber = credential["cardNumber"] | 0;
-      String name = credential["name"] | "";
-      strncpy(credentials[i].name, name.c_str(), sizeof(credentials[i].name) - 1);
-      credentials[i].name[sizeof(credentials[i].name) - 1] = '\0';
+      credentialStore.commit();
     }
+    credentialStore.add(fc, cn, name);
   }
-  else
+  Serial.print("Migrating credentials from JSON: ");
+  Serial.println(credentialStore.pendingCount());
+  saveCredentialsToPreferences();
+}
+
+void loadCredentialsFromPreferences()
+{
+  Serial.println("Loading credentials database...");
+
+  bool migrate = !LittleFS.exists(credentialsDbFile) && LittleFS.exists(credentialsFile);
+  if (!credentialStore.begin(LittleFS, credentialsDbFile, credentialsJournalFile))
+  {
+    Serial.println("Failed to open credentials database.");
+    return;
+  }
+  if (migrate)
   {
-    Serial.println("No valid credentials found.");
+    migrateCredentialsFromJson();
   }
-  Serial.println("Credentials loaded from Preferences:");
-  for (int i = 0; i < validCount; i++)
+
+  Serial.print("Credentials loaded, count: ");
+  Serial.print(credentialStore.count());
+  Serial.print(", RAM: ");
+  Serial.print(credentialStore.memoryUsage());
+  Serial.println(" bytes");
+}
+
+void lockCredentials()
+{
+  xSemaphoreTake(credentialLock, portMAX_DELAY);
+}
+
+// bounded take for the web handlers, false while a compaction runs
+bool tryLockCredentials()
+{
+  return xSemaphoreTake(credentialLock, pdMS_TO_TICKS(CREDENTIAL_LOCK_WAIT)) == pdTRUE;
+}
+
+void unlockCredentials()
+{
+  xSemaphoreGive(credentialLock);
+}
+
+void loadAuditLog()
+{
+  Serial.println("Opening audit log...");
+  if (!auditLog.begin(LittleFS, auditLogFile))
   {
-    Serial.print("Credential ");
-    Serial.print(i);
-    Serial.print(": FC=");
-    Serial.print(credentials[i].facilityCode);
-    Serial.print(", CN=");
-    Serial.print(credentials[i].cardNumber);
-    Serial.print(", Name=");
-    Serial.println(credentials[i].name);
+    Serial.println("Failed to open audit log.");
+    return;
   }
-  Serial.print("Valid Count: ");
-  Serial.println(validCount);
+  Serial.print("Audit log opened, records: ");
+  Serial.println(auditLog.nextSequence() - auditLog.firstSequence());
 }
 
-// Check if credential is valid
-const Credential *checkCredential(uint16_t fc, uint16_t cn)
+void lockAudit()
 {
-  for (unsigned int i = 0; i < validCount; i++)
+  xSemaphoreTake(auditLock, portMAX_DELAY);
+}
+
+void unlockAudit()
+{
+  xSemaphoreGive(auditLock);
+}
+
+// next record of an audit log query; the log is read AUDIT_QUERY_BATCH
+// records at a time so a segment file is not opened for every record
+bool nextAuditRecord(AuditQuery &query, CardRecord &record)
+{
+  if (query.batchIndex >= query.batchSize)
   {
-    if (credentials[i].facilityCode == fc && credentials[i].cardNumber == cn)
+    if (query.sequence >= query.endSequence)
+    {
+      return false;
+    }
+    lockAudit();
+    query.batchSize = auditLog.read(query.sequence, query.batch, AUDIT_QUERY_BATCH);
+    unlockAudit();
+    query.batchIndex = 0;
+    if (query.batchSize == 0)
     {
-      // Found a matching credential, return a pointer to it
-      return &credentials[i];
+      return false;
     }
+    query.sequence = query.batch[query.batchSize - 1].sequence + 1;
   }
-  // No matching credential found, return nullptr
-  return nullptr;
+  record = query.batch[query.batchIndex++];
+  return record.sequence < query.endSequence && record.timestamp < query.endTime;
+}
+
+// Check if credential is valid, the caller holds the credential lock
+bool checkCredential(uint64_t fc, uint64_t cn, Credential &credential)
+{
+  return credentialStore.find(fc, cn, credential);
 }
 
 void ledOnValid()
@@ -390,20 +646,11 @@ void ledOnValid()
     break;
 
   case 1:
-    // Flashing LED
-    digitalWrite(LED, LOW);
-    delay(250);
-    digitalWrite(LED, HIGH);
-    delay(100);
-    digitalWrite(LED, LOW);
-    delay(250);
-    digitalWrite(LED, HIGH);
+    ledOutput.play(ledFlash);
     break;
 
   case 2:
-    digitalWrite(LED, LOW);
-    delay(2000);
-    digitalWrite(LED, HIGH);
+    ledOutput.play(ledLong);
     break;
   }
 }
@@ -417,25 +664,30 @@ void speakerOnValid()
     break;
 
   case 1:
-    // Nice Beeps LED
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
-    delay(50);
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
+    speakerOutput.play(niceBeeps);
     break;
 
   case 2:
-    // Long Beeps
-    digitalWrite(SPK, LOW);
-    delay(2000);
-    digitalWrite(SPK, HIGH);
+    speakerOutput.play(longBeep);
     break;
   }
 }
 
+// releases the door strike for a valid credential
+void relayOnValid()
+{
+  relay1Output.play(doorStrike);
+}
+
+// advances the feedback patterns, called on every pass of the effects task
+void updateOutputs()
+{
+  ledOutput.update();
+  speakerOutput.update();
+  relay1Output.update();
+  relay2Output.update();
+}
+
 // Functions to handle invalid credentials
 void lcdInvalidCredentials()
 {
@@ -450,6 +702,19 @@ void lcdInvalidCredentials()
   lcd.print("    BE REPORTED    ");
 }
 
+void lcdParityError()
+{
+  lcd.clear();
+  lcd.setCursor(0, 0);
+  lcd.print("Card Read: ");
+  lcd.setCursor(11, 0);
+  lcd.print("ERROR");
+  lcd.setCursor(0, 2);
+  lcd.print(centerText("Parity Check Failed", 20));
+  lcd.setCursor(0, 3);
+  lcd.print(centerText("Present Card Again", 20));
+}
+
 void speakerOnFailure()
 {
   switch (spkOnInvalid)
@@ -458,33 +723,35 @@ void speakerOnFailure()
     break;
 
   case 1:
-    // Sad Beeps
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
-    delay(50);
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
-    delay(50);
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
-    delay(50);
-    digitalWrite(SPK, LOW);
-    delay(100);
-    digitalWrite(SPK, HIGH);
+    speakerOutput.play(sadBeeps);
     break;
   }
 }
 
-void printCardData()
+void printCardData(const CardEvent &event)
 {
-  if (MODE == "CTF")
+  CardRecord record = {};
+  record.timestamp = event.captureTime;
+  record.formatId = cardFormatId(cardFormat);
+  record.facilityCode = facilityCode;
+  record.cardNumber = cardNumber;
+  record.setFrame(event.frame);
+  record.reader = event.reader;
+
+  if (event.result == ACCESS_PARITY_ERROR)
   {
-    const Credential *result = checkCredential(facilityCode, cardNumber);
-    if (result != nullptr)
+    // a noisy or truncated frame, don't report it as a card read
+    Serial.println("Error: Card read failed parity check.");
+    lcdParityError();
+    speakerOnFailure();
+
+    record.status = CARD_PARITY_ERROR;
+  }
+  else if (MODE == "CTF")
+  {
+    if (event.result == ACCESS_GRANTED)
     {
+      const Credential *result = &event.credential;
       // Valid credential found
       Serial.println("Valid credential found:");
       Serial.println("FC: " + String(result->facilityCode) + ", CN: " + String(result->cardNumber) + ", Name: " + result->name);
@@ -501,10 +768,10 @@ void printCardData()
       lcd.print("Name: " + String(result->name));
       ledOnValid();
       speakerOnValid();
+      relayOnValid();
 
-      // Update card data status and details
-      status = "Authorized";
-      details = result->name;
+      record.status = CARD_AUTHORIZED;
+      memcpy(record.name, result->name, sizeof(record.name));
     }
     else
     {
@@ -513,19 +780,17 @@ void printCardData()
       lcdInvalidCredentials();
       speakerOnFailure();
 
-      // Update card data status and details
-      status = "Unauthorized";
-      details = "FC: " + String(facilityCode) + ", CN: " + String(cardNumber);
+      record.status = CARD_UNAUTHORIZED;
     }
   }
   else
   {
     // ranges for "valid" bitCount are a bit larger for debugging
-    if (bitCount > 20 && bitCount < 120)
+    if (event.frame.bitCount > 20 && event.frame.bitCount <= MAX_BITS)
     {
       // ignore data caused by noise
       Serial.print("[*] Bit length: ");
-      Serial.println(bitCount);
+      Serial.println(event.frame.bitCount);
       Serial.print("[*] Facility code: ");
       Serial.println(facilityCode);
       Serial.print("[*] Card number: ");
@@ -540,7 +805,7 @@ void printCardData()
       lcd.setCursor(0, 0);
       lcd.print("Card Read: ");
       lcd.setCursor(11, 0);
-      lcd.print(bitCount);
+      lcd.print(event.frame.bitCount);
       lcd.print("bits");
       lcd.setCursor(0, 1);
       lcd.print("FC: ");
@@ -553,228 +818,112 @@ void printCardData()
       hexCardData.toUpperCase();
       lcd.print(hexCardData);
 
-      // Update card data status and details
-      status = "Read";
-      details = "Hex: " + hexCardData;
+      record.status = CARD_READ;
     }
   }
 
-  // Store card data
-  if (cardDataIndex < MAX_CARDS)
+  // Store card data, the oldest read makes room when the history is full
+  cardHistory.add(record);
+  if (auditQueue.push(record) && storageTaskHandle != nullptr)
   {
-    cardDataArray[cardDataIndex].bitCount = bitCount;
-    cardDataArray[cardDataIndex].facilityCode = facilityCode;
-    cardDataArray[cardDataIndex].cardNumber = cardNumber;
-    cardDataArray[cardDataIndex].hexCardData = hexCardData;
-    cardDataArray[cardDataIndex].rawCardData = rawCardData;
-    cardDataArray[cardDataIndex].status = status;
-    cardDataArray[cardDataIndex].details = details;
-    cardDataIndex++;
+    xTaskNotifyGive(storageTaskHandle);
   }
 
-  // Start the display timer
-  lastCardTime = millis();
-  displayingCard = true;
-}
-
-// Process hid cards
-unsigned long decodeHIDFacilityCode(unsigned int start, unsigned int end)
-{
-  unsigned long HIDFacilityCode = 0;
-  for (unsigned int i = start; i < end; i++)
+  // tell the dashboards
+  LiveEvent live = {};
+  live.type = LIVE_CARD;
+  live.latency = (uint32_t)(event.decisionTime - event.captureTime);
+  live.record = record;
+  if (liveCardEvents.push(live) && eventsTaskHandle != nullptr)
   {
-    HIDFacilityCode = (HIDFacilityCode << 1) | databits[i];
+    xTaskNotifyGive(eventsTaskHandle);
   }
-  return HIDFacilityCode;
-}
 
-unsigned long decodeHIDCardNumber(unsigned int start, unsigned int end)
-{
-  unsigned long HIDCardNumber = 0;
-  for (unsigned int i = start; i < end; i++)
-  {
-    HIDCardNumber = (HIDCardNumber << 1) | databits[i];
-  }
-  return HIDCardNumber;
+  // Start the display timer
+  lastCardTime = millis();
+  displayingCard = true;
 }
 
-// Card value processing functions
-// Function to append the card value (bitHolder1 and bitHolder2) to the
-// necessary array then translate that to the two chunks for the card value that
-// will be output
-void setCardChunkBits(unsigned int cardChunk1Offset, unsigned int bitHolderOffset, unsigned int cardChunk2Offset)
+void processHIDCard(const CardEvent &event)
 {
-  for (int i = 19; i >= 0; i--)
+  // the frame was decoded by decideCard(), the layouts live in the card
+  // format table
+  Serial.print("[*] Bit length: ");
+  Serial.println(event.frame.bitCount);
+  cardFormat = event.format;
+  parityValid = event.parityValid;
+  if (cardFormat == nullptr)
   {
-    if (i == 13 || i == cardChunk1Offset)
-    {
-      bitWrite(cardChunk1, i, 1);
-    }
-    else if (i > cardChunk1Offset)
-    {
-      bitWrite(cardChunk1, i, 0);
-    }
-    else
-    {
-      bitWrite(cardChunk1, i, bitRead(bitHolder1, i + bitHolderOffset));
-    }
-    if (i < bitHolderOffset)
-    {
-      bitWrite(cardChunk2, i + cardChunk2Offset, bitRead(bitHolder1, i));
-    }
-    if (i < cardChunk2Offset)
-    {
-      bitWrite(cardChunk2, i, bitRead(bitHolder2, i));
-    }
+    Serial.println("[-] Unsupported bitCount for HID card");
+    return;
   }
-}
 
-String prefixPad(const String &in, const char c, const size_t len)
-{
-  String out = in;
-  while (out.length() < len)
+  Serial.print("[*] Format: ");
+  Serial.println(cardFormat->name);
+  if (!parityValid)
   {
-    out = c + out;
+    Serial.println("[-] Parity check failed");
   }
-  return out;
-}
-
-void processHIDCard()
-{
-  // bits to be decoded differently depending on card format length
-  // see http://www.pagemac.com/projects/rfid/hid_data_formats for more info
-  // also specifically: www.brivo.com/app/static_data/js/calculate.js
-  // Example of full card value
-  // |>   preamble   <| |>   Actual card value   <|
-  // 000000100000000001 11 111000100000100100111000
-  // |> write to chunk1 <| |>  write to chunk2   <|
+  facilityCode = event.facilityCode;
+  cardNumber = event.cardNumber;
 
-  unsigned int cardChunk1Offset, bitHolderOffset, cardChunk2Offset;
-
-  Serial.print("[*] Bit length: ");
-  Serial.println(bitCount);
-  switch (bitCount)
-  {
-  case 26:
-    facilityCode = decodeHIDFacilityCode(1, 9);
-    cardNumber = decodeHIDCardNumber(9, 25);
-    cardChunk1Offset = 2;
-    bitHolderOffset = 20;
-    cardChunk2Offset = 4;
-    break;
-
-  case 27:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 27);
-    cardChunk1Offset = 3;
-    bitHolderOffset = 19;
-    cardChunk2Offset = 5;
-    break;
-
-  case 29:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 29);
-    cardChunk1Offset = 5;
-    bitHolderOffset = 17;
-    cardChunk2Offset = 7;
-    break;
-
-  case 30:
-    facilityCode = decodeHIDFacilityCode(1, 13);
-    cardNumber = decodeHIDCardNumber(13, 29);
-    cardChunk1Offset = 6;
-    bitHolderOffset = 16;
-    cardChunk2Offset = 8;
-    break;
-
-  case 31:
-    facilityCode = decodeHIDFacilityCode(1, 5);
-    cardNumber = decodeHIDCardNumber(5, 28);
-    cardChunk1Offset = 7;
-    bitHolderOffset = 15;
-    cardChunk2Offset = 9;
-    break;
-
-  // modified to wiegand 32 bit format instead of HID
-  case 32:
-    facilityCode = decodeHIDFacilityCode(5, 16);
-    cardNumber = decodeHIDCardNumber(17, 32);
-    cardChunk1Offset = 8;
-    bitHolderOffset = 14;
-    cardChunk2Offset = 10;
-    break;
-
-  case 33:
-    facilityCode = decodeHIDFacilityCode(1, 8);
-    cardNumber = decodeHIDCardNumber(8, 32);
-    cardChunk1Offset = 9;
-    bitHolderOffset = 13;
-    cardChunk2Offset = 11;
-    break;
-
-  case 34:
-    facilityCode = decodeHIDFacilityCode(1, 17);
-    cardNumber = decodeHIDCardNumber(17, 33);
-    cardChunk1Offset = 10;
-    bitHolderOffset = 12;
-    cardChunk2Offset = 12;
-    break;
-
-  case 35:
-    facilityCode = decodeHIDFacilityCode(2, 14);
-    cardNumber = decodeHIDCardNumber(14, 34);
-    cardChunk1Offset = 11;
-    bitHolderOffset = 11;
-    cardChunk2Offset = 13;
-    break;
-
-  case 36:
-    facilityCode = decodeHIDFacilityCode(21, 33);
-    cardNumber = decodeHIDCardNumber(1, 17);
-    cardChunk1Offset = 12;
-    bitHolderOffset = 10;
-    cardChunk2Offset = 14;
-    break;
-
-  default:
-    Serial.println("[-] Unsupported bitCount for HID card");
-    return;
-  }
-
-  setCardChunkBits(cardChunk1Offset, bitHolderOffset, cardChunk2Offset);
-  hexCardData = String(cardChunk1, HEX) + prefixPad(String(cardChunk2, HEX), '0', 6);
-  // hexCardData = String(cardChunk1, HEX) + String(cardChunk2, HEX);
+  char hex[CARD_HEX_SIZE];
+  formatCardHex(event.frame, *cardFormat, hex);
+  hexCardData = hex;
 }
 
-void processCardData()
+void processCardData(const CardEvent &event)
 {
   Serial.println("Processing card data...");
-  // clear the databits array
+  unsigned int count = event.frame.bitCount < MAX_BITS ? event.frame.bitCount : MAX_BITS;
   rawCardData = "";
-  for (unsigned int i = 0; i < bitCount; i++)
+  rawCardData.reserve(count);
+  for (unsigned int i = 0; i < count; i++)
   {
-    rawCardData += String(databits[i]);
+    rawCardData += (char)('0' + event.frame.bit(i));
   }
 
   Serial.print("[*] Raw: ");
   Serial.println(rawCardData);
   Serial.print("[*] bitCount: ");
-  Serial.println(bitCount);
+  Serial.println(event.frame.bitCount);
+  Serial.print("[*] Reader: ");
+  Serial.println(event.reader);
 
-  if (bitCount >= 26 && bitCount <= 96)
+  uint32_t latency = (uint32_t)(event.decisionTime - event.captureTime);
+  if (latency > maxDecisionLatency)
   {
-    processHIDCard();
+    maxDecisionLatency = latency;
   }
+  Serial.print("[*] Decision latency: ");
+  Serial.print(latency);
+  Serial.print(" us, max ");
+  Serial.print(maxDecisionLatency);
+  Serial.println(" us");
+
+  processHIDCard(event);
 }
 
-void clearDatabits()
+// shows a decided read on the LCD and Serial, plays the feedback and adds it
+// to the history
+void handleCardEvent(const CardEvent &event)
 {
-  Serial.println("Clearing databits...");
-  // clear the databits array
-  for (unsigned char i = 0; i < MAX_BITS; i++)
+  // Indicate that a card is being displayed
+  displayingCard = true;
+
+  // Process the card data
+  processCardData(event);
+  // Print the card data if it meets the criteria
+  if (cardFormat != nullptr)
   {
-    databits[i] = 0;
+    // Display card data on LCD and Serial
+    printCardData(event);
+    // Print all stored card data to Serial
+    printAllCardData();
   }
+
+  // Reset the card data for the next read
+  cleanupCardData();
 }
 
 // reset variables and prepare for the next card read
@@ -782,27 +931,10 @@ void cleanupCardData()
 {
   rawCardData = "";
   hexCardData = "";
-  bitCount = 0;
+  cardFormat = nullptr;
+  parityValid = false;
   facilityCode = 0;
   cardNumber = 0;
-  bitHolder1 = 0;
-  bitHolder2 = 0;
-  cardChunk1 = 0;
-  cardChunk2 = 0;
-  status = "";
-  details = "";
-}
-
-bool allBitsAreOnes()
-{
-  for (int i = 0; i < MAX_BITS; i++)
-  {
-    if (databits[i] != 0xFF)
-    {               // Check if each byte is not equal to 0xFF
-      return false; // If any byte is not 0xFF, not all bits are ones
-    }
-  }
-  return true; // All bytes were 0xFF, so all bits are ones
 }
 
 String centerText(const String &text, int width)
@@ -870,25 +1002,306 @@ void updateDisplay()
   }
 }
 
+// sequence of the oldest of the latest count reads
+uint32_t latestCardSequence(uint32_t count)
+{
+  uint32_t last = cardHistory.nextSequence();
+  return last > count ? last - count : 0;
+}
+
 void printAllCardData()
 {
   Serial.println("Previously read card data:");
-  for (int i = 0; i < cardDataIndex; i++)
+  CardRecord record;
+  char hex[CARD_HEX_SIZE];
+  char raw[MAX_BITS + 1];
+  // only the latest reads, the whole history would hold up the effects task
+  CardHistory::Cursor cursor(cardHistory, latestCardSequence(SERIAL_HISTORY_LINES));
+  while (cursor.next(record))
   {
-    Serial.print(i + 1);
-    Serial.print(": Bit length: ");
-    Serial.print(cardDataArray[i].bitCount);
+    formatCardRecord(record, hex, raw);
+    const CardFormat *format = cardFormatById(record.formatId);
+    Serial.print(record.sequence);
+    Serial.print(": Reader: ");
+    Serial.print(record.reader);
+    Serial.print(", Bit length: ");
+    Serial.print(record.bitCount);
+    Serial.print(", Format: ");
+    Serial.print(format != nullptr ? format->name : "");
     Serial.print(", Facility code: ");
-    Serial.print(cardDataArray[i].facilityCode);
+    Serial.print(record.facilityCode);
     Serial.print(", Card number: ");
-    Serial.print(cardDataArray[i].cardNumber);
+    Serial.print(record.cardNumber);
     Serial.print(", Hex: ");
-    Serial.print(cardDataArray[i].hexCardData);
+    Serial.print(hex);
     Serial.print(", Raw: ");
-    Serial.println(cardDataArray[i].rawCardData);
+    Serial.println(raw);
+  }
+}
+
+// next credential of a listing in key order, CREDENTIAL_LIST_BATCH
+// credentials are listed at a time; the caller holds the credential lock
+bool nextListedCredential(CredentialListing &listing, Credential &credential)
+{
+  if (listing.batchIndex >= listing.batchSize)
+  {
+    if (listing.done)
+    {
+      return false;
+    }
+    Credential last;
+    if (listing.batchSize > 0)
+    {
+      last = listing.batch[listing.batchSize - 1];
+    }
+    listing.batchSize = credentialStore.list(listing.batchSize > 0 ? &last : nullptr, listing.batch, CREDENTIAL_LIST_BATCH);
+    listing.batchIndex = 0;
+    listing.done = listing.batchSize < CREDENTIAL_LIST_BATCH;
+    if (listing.batchSize == 0)
+    {
+      return false;
+    }
+  }
+  credential = listing.batch[listing.batchIndex++];
+  return true;
+}
+
+// the card reads from sequence from on and before end, decoded while the
+// response is sent
+JsonElementSource cardSource(uint32_t from, uint32_t end)
+{
+  std::shared_ptr<CardHistory::Cursor> cursor = std::make_shared<CardHistory::Cursor>(cardHistory, from);
+  return [cursor, end](JsonDocument &element)
+  {
+    CardRecord record;
+    if (!cursor->next(record) || record.sequence >= end)
+    {
+      return false;
+    }
+    cardRecordToJson(record, element.to<JsonObject>());
+    return true;
+  };
+}
+
+// every credential in key order
+JsonElementSource userSource()
+{
+  std::shared_ptr<CredentialListing> listing = std::make_shared<CredentialListing>();
+  return [listing](JsonDocument &element)
+  {
+    Credential credential;
+    if (!nextListedCredential(*listing, credential))
+    {
+      return false;
+    }
+    credentialToJson(credential, element.to<JsonObject>());
+    return true;
+  };
+}
+
+// Chunked response sending the stream, which is freed with the response.
+// A stream of credentials fills each chunk under the credential lock; while
+// a compaction holds it the chunk is tried again later.
+AsyncWebServerResponse *beginJsonStream(AsyncWebServerRequest *request, JsonStream *stream, bool credentials)
+{
+  std::shared_ptr<JsonStream> owned(stream);
+  return request->beginChunkedResponse("application/json", [owned, credentials](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                       {
+    if (!credentials) {
+      return owned->fill(buffer, maxLen);
+    }
+    if (!tryLockCredentials()) {
+      return RESPONSE_TRY_AGAIN;
+    }
+    size_t len = owned->fill(buffer, maxLen);
+    unlockCredentials();
+    return len; });
+}
+
+void sendJsonStream(AsyncWebServerRequest *request, JsonStream *stream, bool credentials)
+{
+  request->send(beginJsonStream(request, stream, credentials));
+}
+
+// The page itself is checked on every load, it names the current assets.
+// Sent gzipped when the filesystem image has the compressed copy.
+void sendIndex(AsyncWebServerRequest *request)
+{
+  AsyncWebServerResponse *response = request->beginResponse(LittleFS, indexGzipped ? indexGzFile : indexFile, "text/html");
+  if (indexGzipped)
+  {
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+// Reads after the since sequence, at most limit of them. The ETag changes
+// with every new read and on every boot, a client polling with
+// If-None-Match gets a 304 until then.
+void sendCards(AsyncWebServerRequest *request)
+{
+  uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), nullptr, 10) : 0;
+  uint32_t limit = request->hasParam("limit") ? strtoul(request->getParam("limit")->value().c_str(), nullptr, 10) : UINT32_MAX;
+
+  // the reads sent are from..end; the range names the response, so a client
+  // polling with other parameters never gets a 304 for a body it does not have
+  uint32_t from = since < UINT32_MAX ? since + 1 : UINT32_MAX;
+  if (from < cardHistory.firstSequence())
+  {
+    from = cardHistory.firstSequence();
+  }
+  uint32_t end = min((uint64_t)from + limit, (uint64_t)cardHistory.nextSequence());
+  if (end < from)
+  {
+    end = from;
+  }
+
+  char etag[40];
+  snprintf(etag, sizeof(etag), "\"%08lx-%lu-%lu\"", (unsigned long)bootId, (unsigned long)from, (unsigned long)end);
+  char boot[9];
+  snprintf(boot, sizeof(boot), "%08lx", (unsigned long)bootId);
+
+  AsyncWebServerResponse *response;
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag)
+  {
+    response = request->beginResponse(304);
+  }
+  else
+  {
+    response = beginJsonStream(request, new JsonArrayStream(cardSource(from, end)));
+  }
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("X-Boot-Id", boot);
+  request->send(response);
+}
+
+// The pending credential changes are full, or a compaction holds the store:
+// the storage task compacts right away and the client tries again
+void sendCompacting(AsyncWebServerRequest *request)
+{
+  if (storageTaskHandle != nullptr)
+  {
+    xTaskNotifyGive(storageTaskHandle);
+  }
+  AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Saving credential changes, try again");
+  response->addHeader("Retry-After", "1");
+  request->send(response);
+}
+
+void refuseImport(AsyncWebServerRequest *request, int status, const char *reason)
+{
+  refusedImport = request;
+  refusedImportStatus = status;
+  refusedImportReason = reason;
+}
+
+// Gives up the import being received without waiting for the credential
+// lock, the storage task aborts it
+void dropImport()
+{
+  importState = IMPORT_FAILED;
+  if (storageTaskHandle != nullptr)
+  {
+    xTaskNotifyGive(storageTaskHandle);
+  }
+}
+
+// Merges a received import, on the storage task. Holds the credential lock
+// for a whole database rewrite, the decision task does not need it.
+void finishImport()
+{
+  lockCredentials();
+  bool ok = credentialImporter.finish();
+  unlockCredentials();
+  importState = ok ? IMPORT_DONE : IMPORT_FAILED;
+  Serial.print(ok ? "[*] Imported credentials: " : "[-] Import failed, credentials: ");
+  Serial.println(ok ? credentialImporter.added : credentialImporter.rejected);
+  if (ok && eventsTaskHandle != nullptr)
+  {
+    // liveCredentialEvents has the web handlers as its only producer
+    importEventPending = true;
+    xTaskNotifyGive(eventsTaskHandle);
   }
 }
 
+// the state and the counts of the last import
+void sendImportStatus(AsyncWebServerRequest *request, int status)
+{
+  static const char *const states[] = {"idle", "receiving", "merging", "done", "failed"};
+  JsonDocument doc;
+  doc["status"] = states[importState.load()];
+  doc["added"] = credentialImporter.added;
+  doc["duplicate"] = credentialImporter.duplicate;
+  doc["rejected"] = credentialImporter.rejected;
+  String response;
+  serializeJson(doc, response);
+  request->send(status, "application/json", response);
+}
+
+// queues a credential change for the dashboards, called by the web handlers
+void queueCredentialEvent(LiveEventType type, uint64_t facilityCode, uint64_t cardNumber, const char *name, uint32_t count)
+{
+  LiveEvent live = {};
+  live.type = type;
+  live.count = count;
+  live.credential.facilityCode = facilityCode;
+  live.credential.cardNumber = cardNumber;
+  strncpy(live.credential.name, name, sizeof(live.credential.name) - 1);
+  if (!liveCredentialEvents.push(live))
+  {
+    credentialRefreshPending = true;
+  }
+  if (eventsTaskHandle != nullptr)
+  {
+    xTaskNotifyGive(eventsTaskHandle);
+  }
+}
+
+// "card" events carry the read as /getCards has it plus the decision latency,
+// with the history sequence as event id; "credentials" events the change, or
+// "refresh" after changes were dropped
+void sendLiveEvent(const LiveEvent &event)
+{
+  if (events.count() == 0)
+  {
+    return;
+  }
+
+  JsonDocument doc;
+  String data;
+  if (event.type == LIVE_CARD)
+  {
+    cardRecordToJson(event.record, doc.to<JsonObject>());
+    doc["latency"] = event.latency;
+    serializeJson(doc, data);
+    events.send(data.c_str(), "card", event.record.sequence);
+    return;
+  }
+
+  switch (event.type)
+  {
+  case LIVE_CREDENTIAL_ADDED:
+    doc["action"] = "add";
+    credentialToJson(event.credential, doc["credential"].to<JsonObject>());
+    break;
+  case LIVE_CREDENTIAL_DELETED:
+    doc["action"] = "delete";
+    credentialToJson(event.credential, doc["credential"].to<JsonObject>());
+    break;
+  case LIVE_CREDENTIALS_CHANGED:
+    doc["action"] = "refresh";
+    break;
+  default:
+    doc["action"] = "import";
+    doc["added"] = event.count;
+    break;
+  }
+  serializeJson(doc, data);
+  events.send(data.c_str(), "credentials");
+}
+
 void setupWifi()
 {
   WiFi.softAP(ap_ssid, ap_passphrase, ap_channel, ssid_hidden);
@@ -897,48 +1310,48 @@ void setupWifi()
 void webServer()
 {
 
+  indexGzipped = LittleFS.exists(indexGzFile);
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
-            { 
-              //request->send(200, "text/html", FPSTR(index_html)); 
-              request->send(LittleFS, "/index.html", String()); });
+            { sendIndex(request); });
+  server.on("/index.html", HTTP_GET, [](AsyncWebServerRequest *request)
+            { sendIndex(request); });
 
   server.on("/getCards", HTTP_GET, [](AsyncWebServerRequest *request)
-            {      
-      JsonDocument doc;
-      JsonArray cards = doc.to<JsonArray>();
-      for (int i = 0; i < cardDataIndex; i++) {          
-          JsonObject card = cards.add<JsonObject>();
-          card["bitCount"] = cardDataArray[i].bitCount;
-          card["facilityCode"] = cardDataArray[i].facilityCode;
-          card["cardNumber"] = cardDataArray[i].cardNumber;
-          card["hexCardData"] = cardDataArray[i].hexCardData;
-          card["rawCardData"] = cardDataArray[i].rawCardData;
-          card["status"] = cardDataArray[i].status;
-          card["details"] = cardDataArray[i].details;
-      }
-      String response;
-      serializeJson(doc, response);
-      request->send(200, "application/json", response); });
+            { sendCards(request); });
 
-  server.on("/getUsers", HTTP_GET, [](AsyncWebServerRequest *request)
+  // audit log range: sequences from/to or timestamps start/end in
+  // microseconds, the upper bounds are exclusive; records are read from flash
+  // while the response is sent
+  server.on("/getAuditLog", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-      JsonDocument doc;
-      JsonArray users = doc.to<JsonArray>();
-      for (int i = 0; i < validCount; i++) {          
-          JsonObject user = users.add<JsonObject>();
-          user["facilityCode"] = credentials[i].facilityCode;
-          user["cardNumber"] = credentials[i].cardNumber;
-          user["name"] = credentials[i].name;
+      std::shared_ptr<AuditQuery> query = std::make_shared<AuditQuery>();
+      query->sequence = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), nullptr, 10) : 0;
+      query->endSequence = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), nullptr, 10) : UINT32_MAX;
+      query->endTime = request->hasParam("end") ? strtoll(request->getParam("end")->value().c_str(), nullptr, 10) : INT64_MAX;
+      if (request->hasParam("start")) {
+          lockAudit();
+          uint32_t first = auditLog.findTime(strtoll(request->getParam("start")->value().c_str(), nullptr, 10));
+          unlockAudit();
+          query->sequence = max(query->sequence, first);
       }
-      String response;
-      serializeJson(doc, response);
-      request->send(200, "application/json", response); });
+      sendJsonStream(request, new JsonArrayStream([query](JsonDocument &element) {
+          CardRecord record;
+          if (!nextAuditRecord(*query, record)) {
+              return false;
+          }
+          cardRecordToJson(record, element.to<JsonObject>());
+          return true;
+      })); });
+
+  server.on("/getUsers", HTTP_GET, [](AsyncWebServerRequest *request)
+            { sendJsonStream(request, new JsonArrayStream(userSource()), true); });
 
   server.on("/getSettings", HTTP_GET, [](AsyncWebServerRequest *request)
             {      
       JsonDocument doc;
       doc["mode"] = MODE;
       doc["displayTimeout"] = displayTimeout;
+      doc["frameGap"] = frameGap;
       doc["apSsid"] = ap_ssid;
       doc["apPassphrase"] = ap_passphrase;
       doc["ssidHidden"] = ssid_hidden;
@@ -959,6 +1372,7 @@ void webServer()
       // Parse the JSON and update settings
       MODE = jsonObj["mode"] | "CTF";
       displayTimeout = jsonObj["displayTimeout"] | 30000;
+      frameGap = clampFrameGap(jsonObj["frameGap"] | (int64_t)WIEGAND_FRAME_GAP);
       ap_ssid = jsonObj["apSsid"] | "doorsim";
       ap_passphrase = jsonObj["apPassphrase"] | "";
       ap_channel = jsonObj["apChannel"] | 1;
@@ -976,123 +1390,227 @@ void webServer()
 
   server.on("/addCard", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    if (validCount < MAX_CREDENTIALS) {
-      if (request->hasParam("facilityCode") && request->hasParam("cardNumber") && request->hasParam("name")) {
-        String facilityCodeStr = request->getParam("facilityCode")->value();
-        String cardNumberStr = request->getParam("cardNumber")->value();
-        String name = request->getParam("name")->value();
-
-        credentials[validCount].facilityCode = facilityCodeStr.toInt();
-        credentials[validCount].cardNumber = cardNumberStr.toInt();
-        strncpy(credentials[validCount].name, name.c_str(), sizeof(credentials[validCount].name) - 1);
-        credentials[validCount].name[sizeof(credentials[validCount].name) - 1] = '\0';
-        validCount++;
-        saveCredentialsToPreferences();
+    if (request->hasParam("facilityCode") && request->hasParam("cardNumber") && request->hasParam("name")) {
+      String facilityCodeStr = request->getParam("facilityCode")->value();
+      String cardNumberStr = request->getParam("cardNumber")->value();
+      String name = request->getParam("name")->value();
+
+      uint64_t fc = strtoull(facilityCodeStr.c_str(), nullptr, 10);
+      uint64_t cn = strtoull(cardNumberStr.c_str(), nullptr, 10);
+      Credential existing;
+      if (!tryLockCredentials()) {
+        sendCompacting(request);
+        return;
+      }
+      bool exists = checkCredential(fc, cn, existing);
+      bool full = !exists && credentialStore.pendingFull();
+      bool added = !exists && !full && credentialStore.add(fc, cn, name.c_str());
+      unlockCredentials();
+      if (exists) {
+        request->send(409, "text/plain", "Card already exists");
+      } else if (full) {
+        sendCompacting(request);
+      } else if (added) {
+        queueCredentialEvent(LIVE_CREDENTIAL_ADDED, fc, cn, name.c_str(), 1);
         request->send(200, "text/plain", "Card added successfully");
       } else {
-        request->send(400, "text/plain", "Missing parameters");
+        request->send(500, "text/plain", "Failed to store credential");
       }
     } else {
-      request->send(500, "text/plain", "Max number of credentials reached");
+      request->send(400, "text/plain", "Missing parameters");
     } });
 
   server.on("/deleteCard", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    if (request->hasParam("index")) {
-      int index = request->getParam("index")->value().toInt();
-      if (index >= 0 && index < validCount) {
-        for (int i = index; i < validCount - 1; i++) {
-          credentials[i] = credentials[i + 1];
-        }
-        validCount--;
-        saveCredentialsToPreferences();
+    if (request->hasParam("facilityCode") && request->hasParam("cardNumber")) {
+      uint64_t fc = strtoull(request->getParam("facilityCode")->value().c_str(), nullptr, 10);
+      uint64_t cn = strtoull(request->getParam("cardNumber")->value().c_str(), nullptr, 10);
+      if (!tryLockCredentials()) {
+        sendCompacting(request);
+        return;
+      }
+      bool full = credentialStore.pendingFull();
+      bool removed = !full && credentialStore.remove(fc, cn);
+      unlockCredentials();
+      if (full) {
+        sendCompacting(request);
+      } else if (removed) {
+        queueCredentialEvent(LIVE_CREDENTIAL_DELETED, fc, cn, "", 1);
         request->send(200, "text/plain", "Card deleted successfully");
       } else {
-        request->send(400, "text/plain", "Invalid index");
+        request->send(404, "text/plain", "Card not found");
       }
     } else {
-      request->send(400, "text/plain", "Missing index parameter");
+      request->send(400, "text/plain", "Missing parameters");
     } });
 
-  server.on("/exportData", HTTP_GET, [](AsyncWebServerRequest *request)
+  // Bulk import: the body is parsed while it is received, spilled to flash in
+  // sorted runs and merged into the database in one rewrite by the storage
+  // task. The request is answered with 202 when the body is complete,
+  // /importStatus tells when the merge is done.
+  server.on("/importCredentials", HTTP_POST, [](AsyncWebServerRequest *request)
             {
-    JsonDocument doc;
-    JsonArray users = doc.to<JsonArray>();
-    JsonObject user = users.add<JsonObject>();
-    for (int i = 0; i < validCount; i++) {
-        JsonObject user = users.add<JsonObject>();
-        user["facilityCode"] = credentials[i].facilityCode;
-        user["cardNumber"] = credentials[i].cardNumber;
-        user["name"] = credentials[i].name;
+    if (request == refusedImport) {
+      refusedImport = nullptr;
+      AsyncWebServerResponse *response = request->beginResponse(refusedImportStatus, "text/plain", refusedImportReason);
+      if (refusedImportStatus == 503) {
+        response->addHeader("Retry-After", "1");
+      }
+      request->send(response);
+      return;
     }
-    JsonArray cards = doc["cards"].to<JsonArray>();    
-    for (int i = 0; i < cardDataIndex; i++) {
-        JsonObject card = cards.add<JsonObject>();
-        card["bitCount"] = cardDataArray[i].bitCount;
-        card["facilityCode"] = cardDataArray[i].facilityCode;
-        card["cardNumber"] = cardDataArray[i].cardNumber;
-        card["hexCardData"] = cardDataArray[i].hexCardData;
-        card["rawCardData"] = cardDataArray[i].rawCardData;
+    if (importRequest == nullptr) {
+      request->send(400, "text/plain", "Nothing to import");
+      return;
     }
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response); });
+    if (importRequest != request) {
+      request->send(409, "text/plain", "Import already running");
+      return;
+    }
+    importRequest = nullptr;
+    if (!tryLockCredentials()) {
+      dropImport();
+      sendCompacting(request);
+      return;
+    }
+    credentialImporter.endInput();
+    unlockCredentials();
+    importState = IMPORT_MERGING;
+    xTaskNotifyGive(storageTaskHandle);
+    sendImportStatus(request, 202); }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+            {
+    if (index == 0) {
+      if (importState == IMPORT_RECEIVING || importState == IMPORT_MERGING) {
+        refuseImport(request, 409, "Import already running");
+        return;
+      }
+      if (!tryLockCredentials()) {
+        refuseImport(request, 503, "Saving credential changes, try again");
+        return;
+      }
+      // an import dropped before, the storage task has not aborted it yet
+      if (credentialImporter.active()) {
+        credentialImporter.abort();
+      }
+      bool started = credentialImporter.begin(credentialStore);
+      if (started) {
+        // set under the lock, the storage task aborts dropped imports
+        importState = IMPORT_RECEIVING;
+      }
+      unlockCredentials();
+      if (!started) {
+        refuseImport(request, 503, "Cannot start the import, out of memory or flash");
+        return;
+      }
+      importRequest = request;
+      // nothing is stored when the client goes away before the body is complete
+      request->onDisconnect([request]() {
+        if (importRequest == request) {
+          importRequest = nullptr;
+          dropImport();
+        }
+      });
+    }
+    if (importRequest == request) {
+      // a body chunk is not held back for a compaction, the import is
+      // dropped and answered once the body ends
+      if (!tryLockCredentials()) {
+        importRequest = nullptr;
+        dropImport();
+        refuseImport(request, 503, "Saving credential changes, try again");
+        return;
+      }
+      credentialImporter.feed(data, len);
+      unlockCredentials();
+    } });
+
+  server.on("/importStatus", HTTP_GET, [](AsyncWebServerRequest *request)
+            { sendImportStatus(request, 200); });
+
+  server.on("/exportData", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    JsonObjectStream *stream = new JsonObjectStream();
+    stream->add("users", userSource());
+    stream->add("cards", cardSource(cardHistory.firstSequence(), UINT32_MAX));
+    sendJsonStream(request, stream, true); });
 
-  // Route to load style.css file, and script.js file
+  server.addHandler(&events);
+
+  // script and stylesheet, gzipped and named after their content by
+  // scripts/compress_web.py, so they never change under their name
+  server.serveStatic("/assets/", LittleFS, "/assets/").setCacheControl("public, max-age=31536000, immutable");
+
+  // favicon, settings.json, and script.js and style.css when the image was
+  // built without the compressed copies
   server.serveStatic("/", LittleFS, "/");
 
   server.begin();
 }
 
-void setup()
+// prints how long a boot stage took and starts timing the next one
+void reportBootStage(const char *stage, int64_t &stageStart)
 {
-  pinMode(DATA0, INPUT);
-  pinMode(DATA1, INPUT);
-  pinMode(LED, OUTPUT);
-  pinMode(SPK, OUTPUT);
-  pinMode(RELAY1, OUTPUT);
-  pinMode(RELAY2, OUTPUT);
+  int64_t now = esp_timer_get_time();
+  Serial.print("[*] ");
+  Serial.print(stage);
+  Serial.print(": ");
+  Serial.print((uint32_t)((now - stageStart) / 1000));
+  Serial.println(" ms");
+  stageStart = now;
+}
 
+void setup()
+{
   // turn off led
-  digitalWrite(LED, HIGH);
+  ledOutput.begin(LED, true);
   // turn off buzzers
-  digitalWrite(SPK, HIGH);
+  speakerOutput.begin(SPK, true);
   // turn on relay, lock the door!
-  digitalWrite(RELAY1, HIGH);
+  relay1Output.begin(RELAY1, true);
+  relay2Output.begin(RELAY2, true);
 
+  // boot messages are queued instead of waiting for the UART
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER_SIZE);
   Serial.begin(115200);
-  delay(100);
+  bootId = esp_random();
+  int64_t stageStart = esp_timer_get_time();
   Serial.println("Starting DoorSim...");
 
   Serial.println("LCD Initialized");
-  lcd.init(I2C_SDA, I2C_SCL);
+  lcd.begin(I2C_SDA, I2C_SCL);
   lcd.backlight();
   displaySetupMassage("Initializing...");
 
-  attachInterrupt(DATA0, ISR_INT0, FALLING);
-  attachInterrupt(DATA1, ISR_INT1, FALLING);
-
-  weigandCounter = WEIGAND_WAIT_TIME;
-  for (unsigned char i = 0; i < MAX_BITS; i++)
+  for (unsigned int i = 0; i < READER_COUNT; i++)
   {
-    lastWrittenDatabits[i] = 0;
+    readers[i]->begin();
   }
 
+  credentialLock = xSemaphoreCreateMutex();
+  auditLock = xSemaphoreCreateMutex();
+
   displaySetupMassage("Mounting LittleFS...");
 
   Serial.println("Checking for LittleFS...");
   if (!LittleFS.begin(true))
   {
     Serial.println("An Error has occurred while mounting LittleFS");
+    startPipeline();
     return;
   }
+  reportBootStage("LittleFS", stageStart);
   loadSettingsFromPreferences();
+  reportBootStage("Settings", stageStart);
   loadCredentialsFromPreferences();
+  reportBootStage("Credentials", stageStart);
+  loadAuditLog();
+  reportBootStage("Audit log", stageStart);
 
   displaySetupMassage("Setup WiFi...");
   Serial.println("Setup Wifi...");
   setupWifi();
   Serial.println("Wifi Setup Complete");
+  reportBootStage("WiFi", stageStart);
 
   displaySetupMassage("Starting Web Server...");
 
@@ -1100,41 +1618,193 @@ void setup()
   webServer();
 
   printWelcomeMessage();
+  startPipeline();
 
-  Serial.println("DoorSim Ready!");
+  // from the start of the application, the bootloader not included
+  Serial.print("DoorSim Ready in ");
+  Serial.print((uint32_t)(esp_timer_get_time() / 1000));
+  Serial.println(" ms");
 }
 
-void loop() {
-  updateDisplay();
+// Core 1: assembles the edges of every reader into frames and queues the
+// complete ones for the decision task
+void captureTask(void *arg)
+{
+  for (;;)
+  {
+    for (unsigned int i = 0; i < READER_COUNT; i++)
+    {
+      ReaderChannel &reader = *readers[i];
+      // Assemble the bits received since the last iteration and check if the
+      // card reader has finished reading data
+      if (!readWiegandEdges(reader))
+      {
+        continue;
+      }
+      // Ensure the data is valid (not all bits are 1s)
+      if (!reader.frame().allOnes())
+      {
+        CardEvent event = {};
+        event.frame = reader.frame();
+        event.reader = reader.id();
+        event.captureTime = esp_timer_get_time();
+        if (frameQueue.push(event))
+        {
+          xTaskNotifyGive(decisionTaskHandle);
+        }
+      }
+
+      // Reset the card reader data for the next read
+      reader.clear();
+    }
+    vTaskDelay(1);
+  }
+}
 
-  // Check if the card reader is still receiving data
-  if (!flagDone) {
-    if (--weigandCounter == 0) {
-      flagDone = 1;  // No more data expected
-      Serial.println("Weigand transmission complete.");
+// Core 1: decodes the frames and decides on access
+void decisionTask(void *arg)
+{
+  CardEvent event;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (frameQueue.pop(event))
+    {
+      decideCard(event, credentialStore);
+      if (decisionQueue.push(event))
+      {
+        xTaskNotifyGive(effectsTaskHandle);
+      }
+    }
+  }
+}
+
+// Core 0: everything the decision does not wait for, the LCD, feedback
+// outputs, Serial and card history; flash writes go to the storage task
+void effectsTask(void *arg)
+{
+  CardEvent event;
+  for (;;)
+  {
+    updateDisplay();
+    updateOutputs();
+    reportDroppedEdges();
+
+    while (decisionQueue.pop(event))
+    {
+      handleCardEvent(event);
     }
+
+    // woken up early by new decisions, the timeout paces the feedback patterns
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5));
   }
+}
 
-  // Check if the card reader has finished reading data
-  if (bitCount > 0 && flagDone) {
-    // Indicate that a card is being displayed
-    displayingCard = true;
-
-    // Ensure the data is valid (not all bits are 1s)
-    if (!allBitsAreOnes()) { 
-      // Process the card data     
-      processCardData();
-      // Print the card data if it meets the criteria
-      if (bitCount >= 26 && bitCount <= 36 || bitCount == 96) {
-        // Display card data on LCD and Serial
-        printCardData();
-        // Print all stored card data to Serial
-        printAllCardData();
+// Core 0, below the effects task: the flash writes, audit records,
+// credential compaction and imports
+void storageTask(void *arg)
+{
+  CardRecord record;
+  for (;;)
+  {
+    // woken up by new reads, imports and full credential changes, the
+    // timeout checks the idle conditions
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STORAGE_POLL_TIME));
+
+    if (!auditQueue.isEmpty())
+    {
+      lockAudit();
+      while (auditQueue.pop(record))
+      {
+        auditLog.append(record);
       }
+      unlockAudit();
     }
 
-    // Reset the card reader data for the next read
-    cleanupCardData();
-    clearDatabits();
+    // Write the buffered audit records once the readers are quiet, or when
+    // the oldest one has waited long enough
+    if (auditLog.buffered() && (auditLog.flushDue() || millis() - lastCardTime >= AUDIT_IDLE_TIME))
+    {
+      lockAudit();
+      auditLog.flush();
+      unlockAudit();
+    }
+
+    if (importState == IMPORT_MERGING)
+    {
+      finishImport();
+    }
+    else if (importState == IMPORT_FAILED && credentialImporter.active())
+    {
+      lockCredentials();
+      if (importState == IMPORT_FAILED && credentialImporter.active())
+      {
+        credentialImporter.abort();
+      }
+      unlockCredentials();
+    }
+
+    // a change the decision task does not see yet, its table could not be
+    // built; compaction and imports wait for it as well
+    if (credentialStore.publishDue())
+    {
+      lockCredentials();
+      credentialStore.republish();
+      unlockCredentials();
+    }
+
+    // Compact the credential journal while no card is being read and no
+    // import is received, or as soon as no frame is waiting once changes are
+    // turned away
+    if ((credentialStore.pendingFull() ||
+         (credentialStore.compactionDue() && importState != IMPORT_RECEIVING && readersIdle() && millis() - lastCardTime >= COMPACT_IDLE_TIME)) &&
+        frameQueue.isEmpty())
+    {
+      lockCredentials();
+      saveCredentialsToPreferences();
+      unlockCredentials();
+    }
   }
-}
\ No newline at end of file
+}
+
+// Core 0: sends the queued events to the connected dashboards
+void eventsTask(void *arg)
+{
+  LiveEvent event;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (liveCardEvents.pop(event) || liveCredentialEvents.pop(event))
+    {
+      sendLiveEvent(event);
+    }
+    if (importEventPending.exchange(false))
+    {
+      event = {};
+      event.type = LIVE_CREDENTIALS_IMPORTED;
+      event.count = credentialImporter.added;
+      sendLiveEvent(event);
+    }
+    // after the queued changes, which the dropped one came behind
+    if (credentialRefreshPending.exchange(false))
+    {
+      event = {};
+      event.type = LIVE_CREDENTIALS_CHANGED;
+      sendLiveEvent(event);
+    }
+  }
+}
+
+void startPipeline()
+{
+  xTaskCreatePinnedToCore(eventsTask, "events", 4096, nullptr, 1, &eventsTaskHandle, 0);
+  xTaskCreatePinnedToCore(effectsTask, "effects", 8192, nullptr, 1, &effectsTaskHandle, 0);
+  xTaskCreatePinnedToCore(storageTask, "storage", 8192, nullptr, 0, &storageTaskHandle, 0);
+  xTaskCreatePinnedToCore(decisionTask, "decision", 4096, nullptr, 4, &decisionTaskHandle, 1);
+  xTaskCreatePinnedToCore(captureTask, "capture", 2048, nullptr, 5, nullptr, 1);
+}
+
+void loop() {
+  // all the work is done by the pipeline tasks
+  vTaskDelete(NULL);
+}
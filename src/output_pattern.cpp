@@ -0,0 +1,59 @@
+#include "output_pattern.h"
+
+void OutputChannel::begin(uint8_t pin, bool activeLow)
+{
+  this->pin = pin;
+  this->activeLow = activeLow;
+  pinMode(pin, OUTPUT);
+  stop();
+}
+
+void OutputChannel::write(bool on)
+{
+  digitalWrite(pin, on != activeLow ? HIGH : LOW);
+}
+
+void OutputChannel::play(const OutputPattern &pattern)
+{
+  if (pattern.stepCount == 0)
+  {
+    stop();
+    return;
+  }
+  this->pattern = &pattern;
+  step = 0;
+  stepStart = millis();
+  write(pattern.steps[0].on);
+}
+
+void OutputChannel::stop()
+{
+  pattern = nullptr;
+  write(false);
+}
+
+bool OutputChannel::busy() const
+{
+  return pattern != nullptr;
+}
+
+void OutputChannel::update()
+{
+  if (pattern == nullptr)
+  {
+    return;
+  }
+
+  // catch up on every step that ran out since the last call
+  unsigned long now = millis();
+  while (now - stepStart >= pattern->steps[step].duration)
+  {
+    stepStart += pattern->steps[step].duration;
+    if (++step >= pattern->stepCount)
+    {
+      stop();
+      return;
+    }
+    write(pattern->steps[step].on);
+  }
+}
@@ -0,0 +1,98 @@
+#include "settings_snapshot.h"
+
+#include <string.h>
+
+// header and settings are read and written as one block
+struct SettingsSnapshotFile
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t crc;
+  SettingsSnapshot settings;
+};
+
+static const uint32_t SETTINGS_SNAPSHOT_MAGIC = 0x53535344; // "DSSS"
+// bump when SettingsSnapshot changes, older files are then imported again
+static const uint16_t SETTINGS_SNAPSHOT_VERSION = 1;
+
+// CRC-32 (IEEE), bit by bit; the snapshot is a few hundred bytes read once
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; i++)
+  {
+    crc ^= data[i];
+    for (unsigned int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+bool readSettingsSnapshot(fs::FS &fs, const char *path, SettingsSnapshot &settings)
+{
+  if (!fs.exists(path))
+  {
+    return false;
+  }
+  File in = fs.open(path, "r");
+  if (!in)
+  {
+    return false;
+  }
+
+  SettingsSnapshotFile file;
+  bool ok = in.read((uint8_t *)&file, sizeof(file)) == sizeof(file);
+  in.close();
+  if (!ok || file.magic != SETTINGS_SNAPSHOT_MAGIC || file.version != SETTINGS_SNAPSHOT_VERSION || file.size != sizeof(file.settings) ||
+      file.crc != crc32((const uint8_t *)&file.settings, sizeof(file.settings)))
+  {
+    return false;
+  }
+
+  settings = file.settings;
+  // strings written by a damaged firmware still end
+  settings.mode[sizeof(settings.mode) - 1] = '\0';
+  settings.apSsid[sizeof(settings.apSsid) - 1] = '\0';
+  settings.apPassphrase[sizeof(settings.apPassphrase) - 1] = '\0';
+  settings.customMessage[sizeof(settings.customMessage) - 1] = '\0';
+  settings.welcomeMessage[sizeof(settings.welcomeMessage) - 1] = '\0';
+  return true;
+}
+
+bool writeSettingsSnapshot(fs::FS &fs, const char *path, const SettingsSnapshot &settings)
+{
+  SettingsSnapshotFile file = {};
+  file.magic = SETTINGS_SNAPSHOT_MAGIC;
+  file.version = SETTINGS_SNAPSHOT_VERSION;
+  file.size = sizeof(file.settings);
+  file.settings = settings;
+  file.crc = crc32((const uint8_t *)&file.settings, sizeof(file.settings));
+
+  String temp = String(path) + ".tmp";
+  File out = fs.open(temp, "w");
+  if (!out)
+  {
+    return false;
+  }
+  bool ok = out.write((const uint8_t *)&file, sizeof(file)) == sizeof(file);
+  out.close();
+  if (ok && fs.exists(path))
+  {
+    fs.remove(path);
+  }
+  if (!ok || !fs.rename(temp, path))
+  {
+    fs.remove(temp);
+    return false;
+  }
+  return true;
+}
+
+void setSnapshotText(char *field, size_t size, const char *text)
+{
+  strncpy(field, text, size - 1);
+  field[size - 1] = '\0';
+}
@@ -0,0 +1,205 @@
+#include "wiegand.h"
+
+static_assert((EDGE_RING_SIZE & (EDGE_RING_SIZE - 1)) == 0, "EDGE_RING_SIZE must be a power of two");
+
+bool IRAM_ATTR EdgeRing::push(uint8_t bit, uint32_t timestamp)
+{
+  uint32_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) >= EDGE_RING_SIZE)
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  WiegandEdge &edge = edges[h & (EDGE_RING_SIZE - 1)];
+  edge.bit = bit;
+  edge.timestamp = timestamp;
+  // publish the slot only once it is fully written
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+bool EdgeRing::pop(WiegandEdge &edge)
+{
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  if (t == head.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+  edge = edges[t & (EDGE_RING_SIZE - 1)];
+  // hand the slot back to the producer
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+bool EdgeRing::peek(WiegandEdge &edge) const
+{
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  if (t == head.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+  edge = edges[t & (EDGE_RING_SIZE - 1)];
+  return true;
+}
+
+bool EdgeRing::isEmpty() const
+{
+  return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+}
+
+uint32_t EdgeRing::droppedEdges() const
+{
+  return dropped.load(std::memory_order_relaxed);
+}
+
+void WiegandFrame::clear()
+{
+  for (unsigned int i = 0; i < FRAME_WORDS; i++)
+  {
+    words[i] = 0;
+  }
+  bitCount = 0;
+}
+
+void WiegandFrame::append(uint8_t bit)
+{
+  if (bitCount < MAX_BITS)
+  {
+    words[bitCount >> 5] |= (uint32_t)(bit & 1) << (31 - (bitCount & 31));
+  }
+  bitCount++;
+}
+
+uint8_t WiegandFrame::bit(unsigned int index) const
+{
+  if (index >= MAX_BITS)
+  {
+    return 0;
+  }
+  return (words[index >> 5] >> (31 - (index & 31))) & 1;
+}
+
+uint32_t WiegandFrame::bits(unsigned int start, unsigned int length) const
+{
+  if (length == 0 || start >= MAX_BITS)
+  {
+    return 0;
+  }
+  unsigned int word = start >> 5;
+  unsigned int offset = start & 31;
+  uint64_t window = (uint64_t)words[word] << 32;
+  if (word + 1 < FRAME_WORDS)
+  {
+    window |= words[word + 1];
+  }
+  uint32_t mask = length >= 32 ? 0xFFFFFFFF : ((uint32_t)1 << length) - 1;
+  return (uint32_t)(window >> (64 - offset - length)) & mask;
+}
+
+uint64_t WiegandFrame::bits64(unsigned int start, unsigned int length) const
+{
+  if (length <= 32)
+  {
+    return bits(start, length);
+  }
+  return ((uint64_t)bits(start, length - 32) << 32) | bits(start + length - 32, 32);
+}
+
+bool WiegandFrame::allOnes() const
+{
+  unsigned int count = bitCount < MAX_BITS ? bitCount : MAX_BITS;
+  if (count == 0)
+  {
+    return false;
+  }
+  unsigned int fullWords = count >> 5;
+  for (unsigned int i = 0; i < fullWords; i++)
+  {
+    if (words[i] != 0xFFFFFFFF)
+    {
+      return false;
+    }
+  }
+  unsigned int rest = count & 31;
+  if (rest == 0)
+  {
+    return true;
+  }
+  uint32_t mask = 0xFFFFFFFF << (32 - rest);
+  return (words[fullWords] & mask) == mask;
+}
+
+bool FrameAssembler::poll(EdgeRing &ring, uint32_t now, uint32_t gap)
+{
+  WiegandEdge edge;
+  while (!done && ring.peek(edge))
+  {
+    // an edge after a long enough gap belongs to the next frame, leave it
+    // in the ring until the current frame has been processed
+    if (current.bitCount > 0 && edge.timestamp - lastEdgeTime >= gap)
+    {
+      done = true;
+      break;
+    }
+    ring.pop(edge);
+    current.append(edge.bit);
+    lastEdgeTime = edge.timestamp;
+  }
+
+  // signed, an edge drained above may be newer than now
+  if (current.bitCount > 0 && !done && (int32_t)(now - lastEdgeTime) >= (int32_t)gap)
+  {
+    done = true; // No more data expected
+  }
+  return done;
+}
+
+const WiegandFrame &FrameAssembler::frame() const
+{
+  return current;
+}
+
+void FrameAssembler::clear()
+{
+  current.clear();
+  done = false;
+}
+
+ReaderChannel::ReaderChannel(uint8_t id) : readerId(id)
+{
+}
+
+bool IRAM_ATTR ReaderChannel::pushEdge(uint8_t bit, uint32_t timestamp)
+{
+  return edges.push(bit, timestamp);
+}
+
+bool ReaderChannel::poll(uint32_t now, uint32_t gap)
+{
+  return assembler.poll(edges, now, gap);
+}
+
+const WiegandFrame &ReaderChannel::frame() const
+{
+  return assembler.frame();
+}
+
+void ReaderChannel::clear()
+{
+  assembler.clear();
+}
+
+bool ReaderChannel::isIdle() const
+{
+  return edges.isEmpty();
+}
+
+uint32_t ReaderChannel::droppedEdges() const
+{
+  return edges.droppedEdges();
+}
+
+uint8_t ReaderChannel::id() const
+{
+  return readerId;
+}
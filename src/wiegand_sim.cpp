@@ -0,0 +1,237 @@
+#include "wiegand_sim.h"
+
+#include <algorithm>
+#include <chrono>
+
+// frames sent after the expected one that a captured frame is compared with,
+// the ones skipped to find it were lost
+#define SIM_MATCH_WINDOW 8
+
+PulseTrain::PulseTrain(const PulseTrainConfig &config, uint32_t seed) : config(config), generator(seed), time(config.startTime)
+{
+}
+
+int32_t PulseTrain::jitter()
+{
+  if (config.jitter == 0)
+  {
+    return 0;
+  }
+  return (int32_t)(generator() % (2 * config.jitter + 1)) - (int32_t)config.jitter;
+}
+
+void PulseTrain::addFrame(const WiegandFrame &frame)
+{
+  std::uniform_real_distribution<float> chance(0, 1);
+  unsigned int count = frame.bitCount < MAX_BITS ? frame.bitCount : MAX_BITS;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    uint64_t start = time + (uint64_t)i * config.bitInterval;
+    // the shift never moves a pulse before the start of the frame
+    int32_t shift = jitter();
+    pulses.push_back({shift < 0 && (uint64_t)-shift > start - time ? time : start + shift, config.pulseWidth, frame.bit(i)});
+    if (config.glitchRate > 0 && chance(generator) < config.glitchRate)
+    {
+      // somewhere between this pulse and the next, on either line
+      uint64_t at = start + config.pulseWidth + generator() % config.bitInterval;
+      pulses.push_back({at, config.glitchWidth, (uint8_t)(generator() & 1)});
+      glitchCount++;
+    }
+  }
+  sent.push_back(frame);
+  time += (uint64_t)(count > 0 ? count - 1 : 0) * config.bitInterval + config.pulseWidth + config.frameGap;
+}
+
+std::vector<SimulatedEdge> PulseTrain::edges() const
+{
+  std::vector<Pulse> ordered = pulses;
+  std::stable_sort(ordered.begin(), ordered.end(), [](const Pulse &a, const Pulse &b) { return a.start < b.start; });
+
+  // a line only falls when it is not held low already
+  std::vector<SimulatedEdge> falling;
+  falling.reserve(ordered.size());
+  uint64_t lowUntil[2] = {0, 0};
+  bool low[2] = {false, false};
+  for (const Pulse &pulse : ordered)
+  {
+    uint64_t end = pulse.start + pulse.width;
+    if (low[pulse.line] && pulse.start < lowUntil[pulse.line])
+    {
+      lowUntil[pulse.line] = std::max(lowUntil[pulse.line], end);
+      continue;
+    }
+    falling.push_back({pulse.start, pulse.line, 0});
+    low[pulse.line] = true;
+    lowUntil[pulse.line] = end;
+  }
+  return falling;
+}
+
+const std::vector<WiegandFrame> &PulseTrain::frames() const
+{
+  return sent;
+}
+
+uint64_t PulseTrain::endTime() const
+{
+  return time;
+}
+
+size_t PulseTrain::glitches() const
+{
+  return glitchCount;
+}
+
+double SimulationResult::framesPerSecond() const
+{
+  return simulatedTime > 0 ? framesCorrect * 1e6 / simulatedTime : 0;
+}
+
+double SimulationResult::accuracy() const
+{
+  return framesCaptured > 0 ? (double)framesCorrect / framesCaptured : 0;
+}
+
+double SimulationResult::dropRate() const
+{
+  return framesSent > 0 ? (double)(framesSent - framesCorrect) / framesSent : 0;
+}
+
+WiegandSimulator::WiegandSimulator(const CaptureConfig &config) : config(config)
+{
+}
+
+void WiegandSimulator::isrData0(size_t reader)
+{
+  readers[reader].channel->pushEdge(0, (uint32_t)now);
+}
+
+void WiegandSimulator::isrData1(size_t reader)
+{
+  readers[reader].channel->pushEdge(1, (uint32_t)now);
+}
+
+static bool sameFrame(const WiegandFrame &a, const WiegandFrame &b)
+{
+  if (a.bitCount != b.bitCount)
+  {
+    return false;
+  }
+  unsigned int count = a.bitCount < MAX_BITS ? a.bitCount : MAX_BITS;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    if (a.bit(i) != b.bit(i))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void WiegandSimulator::score(Reader &reader, const WiegandFrame &frame, SimulationResult &result)
+{
+  const std::vector<WiegandFrame> &sent = *reader.sent;
+  result.framesCaptured++;
+  for (size_t i = reader.next; i < sent.size() && i < reader.next + SIM_MATCH_WINDOW; i++)
+  {
+    if (sameFrame(frame, sent[i]))
+    {
+      result.framesCorrect++;
+      reader.next = i + 1;
+      return;
+    }
+  }
+
+  // what the decision task would make of it
+  result.framesMangled++;
+  bool parityValid;
+  const CardFormat *format = detectCardFormat(frame, parityValid);
+  if (format != nullptr && parityValid)
+  {
+    result.framesUndetected++;
+  }
+}
+
+SimulationResult WiegandSimulator::run(const PulseTrain &train)
+{
+  return run(std::vector<const PulseTrain *>{&train})[0];
+}
+
+std::vector<SimulationResult> WiegandSimulator::run(const std::vector<const PulseTrain *> &trains)
+{
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::vector<SimulationResult> results(trains.size(), SimulationResult());
+  std::vector<SimulatedEdge> edges;
+  uint64_t end = 0;
+  readers.clear();
+  for (size_t i = 0; i < trains.size(); i++)
+  {
+    readers.push_back({std::unique_ptr<ReaderChannel>(new ReaderChannel(i + 1)), &trains[i]->frames(), 0});
+    results[i].framesSent = trains[i]->frames().size();
+    for (SimulatedEdge edge : trains[i]->edges())
+    {
+      edge.reader = i;
+      edges.push_back(edge);
+    }
+    end = std::max(end, trains[i]->endTime());
+  }
+  std::stable_sort(edges.begin(), edges.end(), [](const SimulatedEdge &a, const SimulatedEdge &b) { return a.time < b.time; });
+
+  uint64_t start = edges.empty() ? end : edges.front().time;
+  uint64_t poll = start + config.pollInterval;
+  uint64_t nextStall = config.stallInterval > 0 ? start + config.stallInterval : UINT64_MAX;
+  size_t e = 0;
+  for (;;)
+  {
+    if (poll >= nextStall && config.stallTime > 0)
+    {
+      // the capture task is held up, the interrupts keep coming
+      poll += config.stallTime;
+      nextStall += config.stallInterval;
+    }
+    while (e < edges.size() && edges[e].time <= poll)
+    {
+      now = edges[e].time;
+      if (edges[e].line == 0)
+      {
+        isrData0(edges[e].reader);
+      }
+      else
+      {
+        isrData1(edges[e].reader);
+      }
+      e++;
+    }
+
+    // one iteration of captureTask()
+    now = poll;
+    bool busy = e < edges.size();
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+      ReaderChannel &channel = *readers[i].channel;
+      if (channel.poll((uint32_t)now, config.frameGap))
+      {
+        if (!channel.frame().allOnes())
+        {
+          score(readers[i], channel.frame(), results[i]);
+        }
+        channel.clear();
+      }
+      busy = busy || !channel.isIdle() || channel.frame().bitCount > 0;
+    }
+    if (!busy)
+    {
+      break;
+    }
+    poll += config.pollInterval;
+  }
+
+  double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  for (size_t i = 0; i < readers.size(); i++)
+  {
+    results[i].edgesDropped = readers[i].channel->droppedEdges();
+    results[i].simulatedTime = std::max(end, now) - start;
+    results[i].hostSeconds = hostSeconds;
+  }
+  return results;
+}
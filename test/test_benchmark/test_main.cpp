@@ -0,0 +1,437 @@
+// Benchmarks of the card pipeline code shared with the firmware, built for the
+// host by env:native:
+//
+//   pio test -e native -v
+//
+// Every benchmark checks what it computed and prints the time per operation.
+// The numbers are for comparing changes on the same machine, they are not the
+// timings of the ESP32.
+
+#include <unity.h>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "wiegand.h"
+#include "card_formats.h"
+#include "card_history.h"
+#include "card_decoder.h"
+#include "credential_db.h"
+#include "credential_store.h"
+
+typedef std::chrono::steady_clock Clock;
+
+#define DECODE_ROUNDS 200000
+#define LOOKUPS 200000
+#define HISTORY_APPENDS 1000000
+#define JSON_RECORDS 100000
+
+static std::mt19937_64 generator(2024);
+static char benchRoot[] = "/tmp/doorsim-bench-XXXXXX";
+// keeps the compiler from dropping the work being timed
+static volatile uint64_t sink;
+
+static void report(const char *name, size_t operations, Clock::time_point start)
+{
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  printf("%-32s %10.1f ns/op %10zu ops\n", name, ns / operations, operations);
+}
+
+// the value as the field holds it
+static uint64_t fieldValue(const BitField &field, uint64_t value)
+{
+  return field.length >= 64 ? value : value & (((uint64_t)1 << field.length) - 1);
+}
+
+struct EncodedCard
+{
+  WiegandFrame frame;
+  const CardFormat *format;
+  uint64_t facilityCode;
+  uint64_t cardNumber;
+};
+
+// one card of every registered format, with random fields
+static std::vector<EncodedCard> encodeAllFormats()
+{
+  std::vector<EncodedCard> cards;
+  for (uint8_t id = 0; cardFormatById(id) != nullptr; id++)
+  {
+    EncodedCard card;
+    card.format = cardFormatById(id);
+    card.facilityCode = fieldValue(card.format->facilityCode, generator());
+    card.cardNumber = fieldValue(card.format->cardNumber, generator());
+    encodeCardFrame(*card.format, card.facilityCode, card.cardNumber, card.frame);
+    cards.push_back(card);
+  }
+  return cards;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void benchFrameAssembly()
+{
+  EncodedCard card = encodeAllFormats()[0];
+  EdgeRing ring;
+  FrameAssembler assembler;
+  uint32_t time = 0;
+  uint64_t checksum = 0;
+
+  Clock::time_point start = Clock::now();
+  for (unsigned int round = 0; round < DECODE_ROUNDS; round++)
+  {
+    for (unsigned int i = 0; i < card.frame.bitCount; i++)
+    {
+      ring.push(card.frame.bit(i), time);
+      time += 2000;
+    }
+    TEST_ASSERT_TRUE(assembler.poll(ring, time + 10000, 5000));
+    checksum += assembler.frame().words[0];
+    assembler.clear();
+    time += 20000;
+  }
+  report("frame assembly (26 bits)", DECODE_ROUNDS, start);
+  TEST_ASSERT_EQUAL_UINT64((uint64_t)card.frame.words[0] * DECODE_ROUNDS, checksum);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.droppedEdges());
+}
+
+static void benchDecode()
+{
+  std::vector<EncodedCard> cards = encodeAllFormats();
+  for (const EncodedCard &card : cards)
+  {
+    bool parityValid;
+    const CardFormat *format = detectCardFormat(card.frame, parityValid);
+    TEST_ASSERT_TRUE(parityValid);
+    // formats sharing a length can't tell the frame apart, only the fields
+    // of the format found have to match
+    if (format == card.format)
+    {
+      TEST_ASSERT_EQUAL_UINT64(card.facilityCode, decodeFacilityCode(card.frame, *format));
+      TEST_ASSERT_EQUAL_UINT64(card.cardNumber, decodeCardNumber(card.frame, *format));
+    }
+  }
+
+  uint64_t checksum = 0;
+  Clock::time_point start = Clock::now();
+  for (unsigned int round = 0; round < DECODE_ROUNDS; round++)
+  {
+    for (const EncodedCard &card : cards)
+    {
+      bool parityValid;
+      const CardFormat *format = detectCardFormat(card.frame, parityValid);
+      checksum += decodeFacilityCode(card.frame, *format) + decodeCardNumber(card.frame, *format) + parityValid;
+    }
+  }
+  report("decode (all formats)", DECODE_ROUNDS * cards.size(), start);
+  sink = checksum;
+
+  char hex[CARD_HEX_SIZE];
+  start = Clock::now();
+  for (unsigned int round = 0; round < DECODE_ROUNDS; round++)
+  {
+    for (const EncodedCard &card : cards)
+    {
+      formatCardHex(card.frame, *card.format, hex);
+      checksum += hex[0];
+    }
+  }
+  report("hex (all formats)", DECODE_ROUNDS * cards.size(), start);
+  sink = checksum;
+}
+
+// a store holding count random credentials, written as one database file
+static bool buildStore(fs::FS &fs, const char *path, const char *journalPath, size_t count, std::vector<Credential> &credentials,
+                       CredentialStore &store)
+{
+  // a card every store grants, whatever the random ones are
+  std::set<std::pair<uint64_t, uint64_t>> keys = {{42, 4242}};
+  while (keys.size() < count)
+  {
+    keys.insert({generator() % 256, generator() % 100000000});
+  }
+  credentials.clear();
+  for (const std::pair<uint64_t, uint64_t> &key : keys)
+  {
+    Credential credential = {key.first, key.second, {}, 0};
+    snprintf(credential.name, sizeof(credential.name), "User %zu", credentials.size());
+    credentials.push_back(credential);
+  }
+
+  CredentialDb db;
+  if (!db.begin(fs, path) || !db.merge(credentials.data(), credentials.size()))
+  {
+    return false;
+  }
+  db.end();
+  return store.begin(fs, path, journalPath);
+}
+
+static void benchLookup(size_t count)
+{
+  fs::FS fs(benchRoot);
+  char path[32];
+  char journalPath[32];
+  snprintf(path, sizeof(path), "/credentials.%zu.db", count);
+  snprintf(journalPath, sizeof(journalPath), "/credentials.%zu.log", count);
+  std::vector<Credential> credentials;
+  // the store keeps a file open and the table it publishes for as long as
+  // the program runs, like on the device
+  CredentialStore *store = new CredentialStore();
+  TEST_ASSERT_TRUE(buildStore(fs, path, journalPath, count, credentials, *store));
+  TEST_ASSERT_EQUAL_UINT32(count, store->count());
+
+  std::vector<size_t> order(LOOKUPS);
+  for (size_t &index : order)
+  {
+    index = generator() % credentials.size();
+  }
+  Credential found;
+  size_t hits = 0;
+  char name[40];
+  snprintf(name, sizeof(name), "lookup hit (%zu)", count);
+  Clock::time_point start = Clock::now();
+  for (size_t index : order)
+  {
+    hits += store->lookup(credentials[index].facilityCode, credentials[index].cardNumber, found);
+  }
+  report(name, LOOKUPS, start);
+  TEST_ASSERT_EQUAL_UINT32(LOOKUPS, hits);
+
+  // card numbers above the ones stored, so every lookup misses
+  snprintf(name, sizeof(name), "lookup miss (%zu)", count);
+  hits = 0;
+  start = Clock::now();
+  for (unsigned int i = 0; i < LOOKUPS; i++)
+  {
+    hits += store->lookup(i % 256, 100000000 + i, found);
+  }
+  report(name, LOOKUPS, start);
+  TEST_ASSERT_EQUAL_UINT32(0, hits);
+
+  // the whole decision of a valid H10301 read
+  CardEvent event = {};
+  encodeCardFrame(*findCardFormat(26), 42, 4242, event.frame);
+  snprintf(name, sizeof(name), "decide H10301 (%zu)", count);
+  start = Clock::now();
+  for (unsigned int i = 0; i < LOOKUPS; i++)
+  {
+    decideCard(event, *store);
+  }
+  report(name, LOOKUPS, start);
+  TEST_ASSERT_EQUAL(ACCESS_GRANTED, event.result);
+
+  // opening the database at boot, from the snapshot of the filter and sparse
+  // index the merge left next to it, and by scanning every record without it
+  CredentialDb db;
+  snprintf(name, sizeof(name), "open database (%zu)", count);
+  start = Clock::now();
+  TEST_ASSERT_TRUE(db.begin(fs, path));
+  report(name, 1, start);
+  TEST_ASSERT_EQUAL_UINT32(count, db.count());
+  TEST_ASSERT_TRUE(db.find(42, 4242, found));
+  db.end();
+  for (const char *generation : {"", ".1"})
+  {
+    fs.remove((std::string(path) + generation + ".idx").c_str());
+  }
+  snprintf(name, sizeof(name), "open database, scan (%zu)", count);
+  start = Clock::now();
+  TEST_ASSERT_TRUE(db.begin(fs, path));
+  report(name, 1, start);
+  TEST_ASSERT_TRUE(db.find(42, 4242, found));
+}
+
+static void benchLookup100()
+{
+  benchLookup(100);
+}
+
+static void benchLookup10k()
+{
+  benchLookup(10000);
+}
+
+static void benchLookup100k()
+{
+  benchLookup(100000);
+}
+
+// reads as a door sees them: a few dozen cards coming back again and again
+static void makeReads(std::vector<CardRecord> &reads, size_t count)
+{
+  std::vector<EncodedCard> cards = encodeAllFormats();
+  std::vector<CardRecord> people(50);
+  for (size_t i = 0; i < people.size(); i++)
+  {
+    const EncodedCard &card = cards[i % 4 == 3 ? generator() % cards.size() : 0];
+    WiegandFrame frame;
+    uint64_t facilityCode = fieldValue(card.format->facilityCode, generator());
+    uint64_t cardNumber = fieldValue(card.format->cardNumber, generator());
+    encodeCardFrame(*card.format, facilityCode, cardNumber, frame);
+    CardRecord &record = people[i];
+    record = {};
+    record.setFrame(frame);
+    record.bitCount = frame.bitCount;
+    record.formatId = cardFormatId(card.format);
+    record.status = (CardStatus)(generator() % 3);
+    if (record.status == CARD_AUTHORIZED)
+    {
+      snprintf(record.name, sizeof(record.name), "Person %zu", i);
+    }
+    record.facilityCode = facilityCode;
+    record.cardNumber = cardNumber;
+  }
+
+  reads.resize(count);
+  int64_t time = 0;
+  for (CardRecord &read : reads)
+  {
+    time += (int64_t)(generator() % 60000) * 1000;
+    read = people[generator() % people.size()];
+    read.timestamp = time;
+  }
+}
+
+// Every read a card not seen before, as while badges are enrolled or a range
+// is scanned: a few facilities whose card numbers go up in small steps
+static void makeDistinctReads(std::vector<CardRecord> &reads, size_t count)
+{
+  const CardFormat *format = cardFormatById(0);
+  uint64_t facilityCodes[4];
+  uint64_t cardNumbers[4];
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    facilityCodes[i] = fieldValue(format->facilityCode, generator());
+    cardNumbers[i] = fieldValue(format->cardNumber, generator());
+  }
+
+  reads.resize(count);
+  int64_t time = 0;
+  for (CardRecord &read : reads)
+  {
+    unsigned int facility = generator() % 4;
+    cardNumbers[facility] = fieldValue(format->cardNumber, cardNumbers[facility] + 1 + generator() % 16);
+    WiegandFrame frame;
+    encodeCardFrame(*format, facilityCodes[facility], cardNumbers[facility], frame);
+    time += (int64_t)(generator() % 60000) * 1000;
+    read = {};
+    read.setFrame(frame);
+    read.formatId = cardFormatId(format);
+    read.status = CARD_UNAUTHORIZED;
+    read.facilityCode = facilityCodes[facility];
+    read.cardNumber = cardNumbers[facility];
+    read.timestamp = time;
+  }
+}
+
+static void measureHistory(const char *name, std::vector<CardRecord> &reads)
+{
+  char label[64];
+  CardHistory *history = new CardHistory();
+
+  Clock::time_point start = Clock::now();
+  for (CardRecord &read : reads)
+  {
+    history->add(read);
+  }
+  snprintf(label, sizeof(label), "history append, %s", name);
+  report(label, reads.size(), start);
+  TEST_ASSERT_EQUAL_UINT32(reads.size() + 1, history->nextSequence());
+
+  CardRecord record;
+  size_t decoded = 0;
+  uint64_t lastCardNumber = 0;
+  CardHistory::Cursor cursor(*history, history->firstSequence());
+  start = Clock::now();
+  while (cursor.next(record))
+  {
+    lastCardNumber = record.cardNumber;
+    decoded++;
+  }
+  snprintf(label, sizeof(label), "history decode, %s", name);
+  report(label, decoded, start);
+  TEST_ASSERT_EQUAL_UINT32(history->nextSequence() - history->firstSequence(), decoded);
+  TEST_ASSERT_EQUAL_UINT64(reads.back().cardNumber, lastCardNumber);
+
+  // everything held comes back as it was added
+  CardHistory::Cursor check(*history, history->firstSequence());
+  while (check.next(record))
+  {
+    const CardRecord &read = reads[record.sequence - 1];
+    TEST_ASSERT_EQUAL(read.bitCount, record.bitCount);
+    TEST_ASSERT_TRUE(memcmp(read.bits, record.bits, sizeof(record.bits)) == 0);
+    TEST_ASSERT_EQUAL_UINT64(read.facilityCode, record.facilityCode);
+    TEST_ASSERT_EQUAL_UINT64(read.cardNumber, record.cardNumber);
+    TEST_ASSERT_TRUE(strncmp(read.name, record.name, sizeof(record.name)) == 0);
+    TEST_ASSERT_EQUAL(read.timestamp / 1000 * 1000, record.timestamp);
+  }
+
+  double perRead = (double)history->memoryUsage() / decoded;
+  snprintf(label, sizeof(label), "history size, %s", name);
+  printf("%-32s %10.1f B/read %8.1fx smaller %8zu reads held\n", label, perRead, sizeof(CardRecord) / perRead, decoded);
+  delete history;
+}
+
+static void benchHistory()
+{
+  std::vector<CardRecord> reads;
+  makeReads(reads, HISTORY_APPENDS);
+  measureHistory("repeated", reads);
+  makeDistinctReads(reads, HISTORY_APPENDS);
+  measureHistory("distinct", reads);
+}
+
+static void benchJson()
+{
+  std::vector<CardRecord> reads;
+  makeReads(reads, 64);
+  static char buffer[1024];
+  size_t bytes = 0;
+
+  Clock::time_point start = Clock::now();
+  for (unsigned int i = 0; i < JSON_RECORDS; i++)
+  {
+    JsonDocument doc;
+    cardRecordToJson(reads[i % reads.size()], doc.to<JsonObject>());
+    bytes += serializeJson(doc, buffer, sizeof(buffer));
+  }
+  report("card to JSON", JSON_RECORDS, start);
+  TEST_ASSERT_TRUE(bytes > 0);
+}
+
+int main()
+{
+  // the credential databases are written below it
+  if (mkdtemp(benchRoot) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(benchFrameAssembly);
+  RUN_TEST(benchDecode);
+  RUN_TEST(benchLookup100);
+  RUN_TEST(benchLookup10k);
+  RUN_TEST(benchLookup100k);
+  RUN_TEST(benchHistory);
+  RUN_TEST(benchJson);
+  int failures = UNITY_END();
+
+  std::filesystem::remove_all(benchRoot);
+  return failures;
+}
@@ -0,0 +1,112 @@
+// Checks of the card format detection on the host:
+//
+//   pio test -e native -f test_formats -v
+//
+// Frames are built with encodeCardFrame() and the format detected from them
+// is compared with the one they were built in.
+
+#include <unity.h>
+#include <string.h>
+
+#include "hal.h"
+#include "wiegand.h"
+#include "card_formats.h"
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static const CardFormat *formatNamed(const char *name)
+{
+  for (uint8_t id = 0; cardFormatById(id) != nullptr; id++)
+  {
+    if (strcmp(cardFormatById(id)->name, name) == 0)
+    {
+      return cardFormatById(id);
+    }
+  }
+  return nullptr;
+}
+
+// the ids of the formats stored with older reads do not change
+static void testStoredIds()
+{
+  TEST_ASSERT_EQUAL(0, cardFormatId(formatNamed("H10301")));
+  TEST_ASSERT_EQUAL(9, cardFormatId(formatNamed("HID 36")));
+  TEST_ASSERT_EQUAL(10, cardFormatId(formatNamed("H10304")));
+  TEST_ASSERT_EQUAL(14, cardFormatId(formatNamed("Raw 128")));
+  TEST_ASSERT_TRUE(findCardFormat(36) == formatNamed("HID 36"));
+  TEST_ASSERT_TRUE(findCardFormat(25) == nullptr);
+}
+
+// a 36 bit frame with the Keyscan parity is C15001, without it HID 36
+static void testSharedLength()
+{
+  const CardFormat *keyscan = formatNamed("C15001");
+  TEST_ASSERT_NOT_NULL(keyscan);
+  WiegandFrame frame;
+  encodeCardFrame(*keyscan, 123, 45678, frame);
+  bool parityValid;
+  const CardFormat *format = detectCardFormat(frame, parityValid);
+  TEST_ASSERT_TRUE(format == keyscan);
+  TEST_ASSERT_TRUE(parityValid);
+  TEST_ASSERT_EQUAL_UINT64(123, decodeFacilityCode(frame, *format));
+  TEST_ASSERT_EQUAL_UINT64(45678, decodeCardNumber(frame, *format));
+
+  // the even parity bit flipped
+  frame.words[0] ^= 0x80000000;
+  format = detectCardFormat(frame, parityValid);
+  TEST_ASSERT_TRUE(format == formatNamed("HID 36"));
+  TEST_ASSERT_TRUE(parityValid);
+}
+
+// a frame of every format is detected with valid parity and, unless another
+// format of its length passes as well, decodes to what it was built from
+static void testEveryFormat()
+{
+  for (uint8_t id = 0; cardFormatById(id) != nullptr; id++)
+  {
+    const CardFormat &built = *cardFormatById(id);
+    uint64_t facilityCode = 0x5A5A5A5A5A5A5A5AULL & ((built.facilityCode.length < 64 ? 1ULL << built.facilityCode.length : 0) - 1);
+    uint64_t cardNumber = 0x3C3C3C3C3C3C3C3CULL & ((built.cardNumber.length < 64 ? 1ULL << built.cardNumber.length : 0) - 1);
+    WiegandFrame frame;
+    encodeCardFrame(built, facilityCode, cardNumber, frame);
+    TEST_ASSERT_TRUE(checkParity(frame, built));
+    bool parityValid;
+    const CardFormat *format = detectCardFormat(frame, parityValid);
+    TEST_ASSERT_NOT_NULL(format);
+    TEST_ASSERT_TRUE(parityValid);
+    TEST_ASSERT_EQUAL(built.bitCount, format->bitCount);
+    if (format == &built)
+    {
+      TEST_ASSERT_EQUAL_UINT64(facilityCode, decodeFacilityCode(frame, built));
+      TEST_ASSERT_EQUAL_UINT64(cardNumber, decodeCardNumber(frame, built));
+    }
+  }
+}
+
+// a frame failing the only format of its length still gets that format
+static void testParityError()
+{
+  const CardFormat *h10301 = findCardFormat(26);
+  WiegandFrame frame;
+  encodeCardFrame(*h10301, 42, 4242, frame);
+  frame.words[0] ^= 0x40000000;
+  bool parityValid;
+  TEST_ASSERT_TRUE(detectCardFormat(frame, parityValid) == h10301);
+  TEST_ASSERT_TRUE(!parityValid);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testStoredIds);
+  RUN_TEST(testSharedLength);
+  RUN_TEST(testEveryFormat);
+  RUN_TEST(testParityError);
+  return UNITY_END();
+}
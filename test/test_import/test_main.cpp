@@ -0,0 +1,242 @@
+// Checks of the streaming credential import on the host:
+//
+//   pio test -e native -f test_import -v
+//
+// The bodies are fed in small chunks, like the web server hands them over,
+// and the imported credentials are compared with what was sent.
+
+#include <unity.h>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "card_decoder.h"
+#include "card_formats.h"
+#include "card_history.h"
+#include "credential_import.h"
+#include "credential_store.h"
+#include "json_stream.h"
+
+// body bytes per feed() call
+#define IMPORT_CHUNK 97
+
+static char testRoot[] = "/tmp/doorsim-import-XXXXXX";
+static int stores = 0;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// a new empty store below the test directory
+static bool openStore(fs::FS &fs, CredentialStore &store)
+{
+  // the store keeps the path pointers
+  static std::deque<std::string> paths;
+  std::string path = "/credentials" + std::to_string(stores++) + ".db";
+  paths.push_back(path);
+  paths.push_back(path + ".journal");
+  return store.begin(fs, paths[paths.size() - 2].c_str(), paths.back().c_str());
+}
+
+static void importBody(CredentialStore &store, const std::string &body, CredentialImporter &importer)
+{
+  TEST_ASSERT_TRUE(importer.begin(store));
+  for (size_t i = 0; i < body.size(); i += IMPORT_CHUNK)
+  {
+    size_t len = body.size() - i < IMPORT_CHUNK ? body.size() - i : IMPORT_CHUNK;
+    importer.feed((const uint8_t *)body.data() + i, len);
+  }
+  importer.endInput();
+  TEST_ASSERT_TRUE(importer.finish());
+}
+
+static std::string readStream(JsonStream &stream)
+{
+  std::string text;
+  uint8_t buffer[IMPORT_CHUNK];
+  size_t n;
+  while ((n = stream.fill(buffer, sizeof(buffer))) > 0)
+  {
+    text.append((const char *)buffer, n);
+  }
+  return text;
+}
+
+// /exportData of one store imported into another gives back the same users,
+// and none of the card reads exported next to them
+static void testExportRoundTrip()
+{
+  fs::FS fs(testRoot);
+  CredentialStore source;
+  TEST_ASSERT_TRUE(openStore(fs, source));
+  for (uint64_t i = 0; i < 300; i++)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "User \"%llu\"", (unsigned long long)i);
+    TEST_ASSERT_TRUE(source.add(10 + i % 3, 1000 + i * 7, name));
+    if (source.pendingFull())
+    {
+      TEST_ASSERT_TRUE(source.commit());
+    }
+  }
+
+  // reads of cards that are no credential, every field a card record has
+  CardHistory *history = new CardHistory();
+  const CardFormat *format = cardFormatById(0);
+  for (uint64_t i = 0; i < 50; i++)
+  {
+    WiegandFrame frame;
+    encodeCardFrame(*format, 200, 50000 + i, frame);
+    CardRecord read = {};
+    read.setFrame(frame);
+    read.formatId = cardFormatId(format);
+    read.status = CARD_UNAUTHORIZED;
+    read.facilityCode = 200;
+    read.cardNumber = 50000 + i;
+    read.timestamp = (int64_t)i * 1000000;
+    history->add(read);
+  }
+
+  std::vector<Credential> users(400);
+  users.resize(source.list(nullptr, users.data(), users.size()));
+  TEST_ASSERT_EQUAL(300, users.size());
+  size_t listed = 0;
+  uint32_t sequence = history->firstSequence();
+  JsonObjectStream stream;
+  stream.add("users", [&](JsonDocument &element)
+             {
+               if (listed >= users.size())
+               {
+                 return false;
+               }
+               credentialToJson(users[listed++], element.to<JsonObject>());
+               return true; });
+  stream.add("cards", [&](JsonDocument &element)
+             {
+               CardRecord record;
+               if (!history->get(sequence++, record))
+               {
+                 return false;
+               }
+               cardRecordToJson(record, element.to<JsonObject>());
+               return true; });
+  std::string body = readStream(stream);
+  delete history;
+
+  CredentialStore target;
+  TEST_ASSERT_TRUE(openStore(fs, target));
+  CredentialImporter importer;
+  importBody(target, body, importer);
+  TEST_ASSERT_EQUAL(300, importer.added);
+  TEST_ASSERT_EQUAL(0, importer.duplicate);
+  TEST_ASSERT_EQUAL(0, importer.rejected);
+  TEST_ASSERT_EQUAL(300, target.count());
+
+  std::vector<Credential> imported(400);
+  imported.resize(target.list(nullptr, imported.data(), imported.size()));
+  TEST_ASSERT_EQUAL(users.size(), imported.size());
+  for (size_t i = 0; i < users.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_UINT64(users[i].facilityCode, imported[i].facilityCode);
+    TEST_ASSERT_EQUAL_UINT64(users[i].cardNumber, imported[i].cardNumber);
+    TEST_ASSERT_TRUE(strcmp(users[i].name, imported[i].name) == 0);
+  }
+  Credential card;
+  TEST_ASSERT_TRUE(!target.find(200, 50000, card));
+}
+
+// the objects of a top-level array are credentials, nested ones are not
+static void testTopLevelArray()
+{
+  fs::FS fs(testRoot);
+  CredentialStore store;
+  TEST_ASSERT_TRUE(openStore(fs, store));
+  CredentialImporter importer;
+  importBody(store,
+             "[{\"facilityCode\": 1, \"cardNumber\": 2, \"name\": \"A\"},"
+             " {\"facilityCode\": \"3\", \"cardNumber\": \"4\", \"name\": \"B\", \"extra\": {\"facilityCode\": 5, \"cardNumber\": 6}},"
+             " [{\"facilityCode\": 7, \"cardNumber\": 8}]]",
+             importer);
+  TEST_ASSERT_EQUAL(2, importer.added);
+  TEST_ASSERT_EQUAL(0, importer.rejected);
+  Credential credential;
+  TEST_ASSERT_TRUE(store.find(3, 4, credential));
+  TEST_ASSERT_TRUE(strcmp(credential.name, "B") == 0);
+  TEST_ASSERT_TRUE(!store.find(5, 6, credential));
+  TEST_ASSERT_TRUE(!store.find(7, 8, credential));
+}
+
+// only the "users" and legacy "credentials" members of an object are read
+static void testObjectMembers()
+{
+  fs::FS fs(testRoot);
+  CredentialStore store;
+  TEST_ASSERT_TRUE(openStore(fs, store));
+  CredentialImporter importer;
+  importBody(store,
+             "{\"settings\": {\"facilityCode\": 1, \"cardNumber\": 1},"
+             " \"note\": \"users\", \"cards\": [{\"facilityCode\": 2, \"cardNumber\": 2}],"
+             " \"users\": [{\"facilityCode\": 3, \"cardNumber\": 3, \"name\": \"[users]\"}],"
+             " \"credentials\": [{\"facilityCode\": 4, \"cardNumber\": 4}]}",
+             importer);
+  TEST_ASSERT_EQUAL(2, importer.added);
+  Credential credential;
+  TEST_ASSERT_TRUE(!store.find(1, 1, credential));
+  TEST_ASSERT_TRUE(!store.find(2, 2, credential));
+  TEST_ASSERT_TRUE(store.find(3, 3, credential));
+  TEST_ASSERT_TRUE(strcmp(credential.name, "[users]") == 0);
+  TEST_ASSERT_TRUE(store.find(4, 4, credential));
+}
+
+// a delete not compacted yet does not win over the import of the same key
+static void testImportAfterDelete()
+{
+  fs::FS fs(testRoot);
+  CredentialStore store;
+  TEST_ASSERT_TRUE(openStore(fs, store));
+  TEST_ASSERT_TRUE(store.add(5, 5, "Old"));
+  TEST_ASSERT_TRUE(store.commit());
+  TEST_ASSERT_TRUE(store.remove(5, 5));
+  TEST_ASSERT_TRUE(store.add(6, 6, "Pending"));
+  TEST_ASSERT_TRUE(store.remove(6, 6));
+
+  CredentialImporter importer;
+  importBody(store, "5,5,New\n6,6,Again\n", importer);
+  TEST_ASSERT_EQUAL(2, importer.added);
+  TEST_ASSERT_EQUAL(0, importer.duplicate);
+  TEST_ASSERT_EQUAL(2, store.count());
+  Credential credential;
+  TEST_ASSERT_TRUE(store.find(5, 5, credential));
+  TEST_ASSERT_TRUE(strcmp(credential.name, "New") == 0);
+  TEST_ASSERT_TRUE(store.find(6, 6, credential));
+  TEST_ASSERT_TRUE(store.lookup(5, 5, credential));
+}
+
+int main()
+{
+  // the credential databases are written below it
+  if (mkdtemp(testRoot) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(testExportRoundTrip);
+  RUN_TEST(testTopLevelArray);
+  RUN_TEST(testObjectMembers);
+  RUN_TEST(testImportAfterDelete);
+  int failures = UNITY_END();
+
+  std::filesystem::remove_all(testRoot);
+  return failures;
+}
@@ -0,0 +1,216 @@
+// Stress scenarios for the capture path, replayed through the simulated
+// reader of wiegand_sim.h on the host:
+//
+//   pio test -e native -f test_simulator -v
+//
+// Every scenario prints what got through: frames sent, captured exactly,
+// mangled (and of those decoded as a valid card all the same), edges lost to
+// the ring, correct frames per simulated second, accuracy and drop rate.
+
+#include <unity.h>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+#include "hal.h"
+#include "wiegand.h"
+#include "card_formats.h"
+#include "wiegand_sim.h"
+
+#define SCENARIO_FRAMES 20000
+
+static std::mt19937_64 generator(7);
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// count random cards, all H10301 or spread over every registered format
+static void addCards(PulseTrain &train, size_t count, bool allFormats)
+{
+  uint8_t formats = 0;
+  while (cardFormatById(formats) != nullptr)
+  {
+    formats++;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    const CardFormat *format = allFormats ? cardFormatById(i % formats) : findCardFormat(26);
+    WiegandFrame frame;
+    encodeCardFrame(*format, generator(), generator(), frame);
+    train.addFrame(frame);
+  }
+}
+
+static SimulationResult simulate(const char *name, const PulseTrainConfig &reader, const CaptureConfig &capture, size_t count,
+                                 bool allFormats)
+{
+  PulseTrain train(reader, generator());
+  addCards(train, count, allFormats);
+  WiegandSimulator *simulator = new WiegandSimulator(capture);
+  SimulationResult result = simulator->run(train);
+  delete simulator;
+
+  printf("%-24s sent %6zu ok %6zu mangled %5zu (valid %4zu) edges lost %6zu | %7.1f frames/s  accuracy %6.2f%%  drop %6.2f%%  "
+         "host %.0f frames/s\n",
+         name, result.framesSent, result.framesCorrect, result.framesMangled, result.framesUndetected, result.edgesDropped,
+         result.framesPerSecond(), result.accuracy() * 100, result.dropRate() * 100, result.framesSent / result.hostSeconds);
+  if (train.glitches() > 0)
+  {
+    printf("%-24s %zu glitches\n", "", train.glitches());
+  }
+  TEST_ASSERT_TRUE(result.framesCorrect <= result.framesSent);
+  TEST_ASSERT_EQUAL(result.framesCaptured, result.framesCorrect + result.framesMangled);
+  return result;
+}
+
+static void cleanAllFormats()
+{
+  SimulationResult result = simulate("clean, all formats", PulseTrainConfig(), CaptureConfig(), SCENARIO_FRAMES, true);
+  TEST_ASSERT_EQUAL(SCENARIO_FRAMES, result.framesCorrect);
+  TEST_ASSERT_EQUAL(0, result.framesMangled);
+  TEST_ASSERT_EQUAL(0, result.edgesDropped);
+}
+
+static void microsWraps()
+{
+  PulseTrainConfig reader;
+  reader.startTime = 0x100000000ULL - 2000000;
+  SimulationResult result = simulate("micros() wrapping", reader, CaptureConfig(), 1000, true);
+  TEST_ASSERT_EQUAL(1000, result.framesCorrect);
+}
+
+// frames just far enough apart for the frame gap to split them
+static void backToBack()
+{
+  PulseTrainConfig reader;
+  reader.bitInterval = 1000;
+  reader.frameGap = 6000;
+  SimulationResult result = simulate("back to back", reader, CaptureConfig(), SCENARIO_FRAMES, true);
+  TEST_ASSERT_EQUAL(SCENARIO_FRAMES, result.framesCorrect);
+}
+
+// a reader pausing less than the frame gap setting runs frames together
+static void gapTooShort()
+{
+  PulseTrainConfig reader;
+  reader.frameGap = 3000;
+  SimulationResult result = simulate("gap below frameGap", reader, CaptureConfig(), SCENARIO_FRAMES, true);
+  TEST_ASSERT_TRUE(result.dropRate() > 0.5);
+}
+
+static void jitter()
+{
+  PulseTrainConfig reader;
+  reader.jitter = 400;
+  SimulationResult result = simulate("jitter 400us", reader, CaptureConfig(), SCENARIO_FRAMES, true);
+  TEST_ASSERT_EQUAL(SCENARIO_FRAMES, result.framesCorrect);
+
+  // pulses overtaking each other swap bits
+  reader.jitter = 1500;
+  result = simulate("jitter 1500us", reader, CaptureConfig(), SCENARIO_FRAMES, true);
+  TEST_ASSERT_TRUE(result.framesMangled > 0);
+}
+
+static void glitches()
+{
+  PulseTrainConfig reader;
+  reader.glitchRate = 0.005;
+  SimulationResult result = simulate("glitches 0.5%/bit", reader, CaptureConfig(), SCENARIO_FRAMES, false);
+  // an extra bit makes a 26 bit frame a 27 bit one, which has no parity and
+  // is counted as valid
+  TEST_ASSERT_TRUE(result.framesMangled > 0);
+}
+
+// a capture task held up long enough for a fast reader to fill the ring
+static void stalledCapture()
+{
+  PulseTrainConfig reader;
+  reader.pulseWidth = 20;
+  reader.bitInterval = 100;
+  reader.frameGap = 6000;
+  CaptureConfig capture;
+  capture.stallInterval = 200000;
+  capture.stallTime = 40000;
+  SimulationResult result = simulate("stalled capture", reader, capture, SCENARIO_FRAMES, true);
+  TEST_ASSERT_TRUE(result.edgesDropped > 0);
+  TEST_ASSERT_TRUE(result.framesCorrect < SCENARIO_FRAMES);
+}
+
+// shortest reader pause that still gets every frame through, and the rate it
+// sustains with 1ms bits
+static void sustainedRate()
+{
+  PulseTrainConfig reader;
+  reader.bitInterval = 1000;
+  double best = 0;
+  uint32_t bestGap = 0;
+  for (uint32_t gap = 20000; gap >= 1000; gap -= 1000)
+  {
+    reader.frameGap = gap;
+    char name[32];
+    snprintf(name, sizeof(name), "H10301 gap %luus", (unsigned long)gap);
+    SimulationResult result = simulate(name, reader, CaptureConfig(), 2000, false);
+    if (result.framesCorrect == result.framesSent)
+    {
+      best = result.framesPerSecond();
+      bestGap = gap;
+    }
+  }
+  printf("%-24s %.1f frames/s with a %luus gap\n", "sustained", best, (unsigned long)bestGap);
+  // the silence between two frames is the gap plus the last pulse
+  TEST_ASSERT_TRUE(bestGap + reader.pulseWidth >= CaptureConfig().frameGap);
+}
+
+// four readers sending at once, each at its own pace, must not see the edges
+// of another
+static void concurrentReaders()
+{
+  std::vector<PulseTrain> trains;
+  for (size_t i = 0; i < 4; i++)
+  {
+    PulseTrainConfig reader;
+    reader.bitInterval = 1000 + 250 * i;
+    reader.jitter = 100;
+    reader.startTime = 137 * i;
+    trains.emplace_back(reader, generator());
+    addCards(trains.back(), SCENARIO_FRAMES / 4, true);
+  }
+  std::vector<const PulseTrain *> sent;
+  for (const PulseTrain &train : trains)
+  {
+    sent.push_back(&train);
+  }
+  WiegandSimulator *simulator = new WiegandSimulator(CaptureConfig());
+  std::vector<SimulationResult> results = simulator->run(sent);
+  delete simulator;
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const SimulationResult &result = results[i];
+    printf("%-24s sent %6zu ok %6zu mangled %5zu edges lost %6zu | %7.1f frames/s\n", i == 0 ? "four readers" : "", result.framesSent,
+           result.framesCorrect, result.framesMangled, result.edgesDropped, result.framesPerSecond());
+    TEST_ASSERT_EQUAL(SCENARIO_FRAMES / 4, result.framesCorrect);
+    TEST_ASSERT_EQUAL(0, result.framesMangled);
+    TEST_ASSERT_EQUAL(0, result.edgesDropped);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(cleanAllFormats);
+  RUN_TEST(microsWraps);
+  RUN_TEST(backToBack);
+  RUN_TEST(gapTooShort);
+  RUN_TEST(jitter);
+  RUN_TEST(glitches);
+  RUN_TEST(stalledCapture);
+  RUN_TEST(sustainedRate);
+  RUN_TEST(concurrentReaders);
+  return UNITY_END();
+}